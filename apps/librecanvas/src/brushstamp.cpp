@@ -0,0 +1,94 @@
+#include "brushstamp.h"
+#include <algorithm>
+#include <cmath>
+
+namespace LibreCanvas {
+
+    BrushStamp::BrushStamp(int size, float hardness, const QPointF& phase)
+    {
+        const float radius = std::max(size, 1) / 2.0f;
+        // One pixel past the radius stays transparent, so a dab never needs clipping to its stamp
+        m_margin = static_cast<int>(std::ceil(radius)) + 1;
+        const int extent = 2 * m_margin + 1;
+        m_coverage = QImage(extent, extent, QImage::Format_Alpha8);
+
+        const float centerX = m_margin + static_cast<float>(phase.x());
+        const float centerY = m_margin + static_cast<float>(phase.y());
+        const float inner = radius * std::clamp(hardness, 0.0f, 1.0f);
+        const float falloff = radius - inner;
+        for (int y = 0; y < extent; ++y) {
+            uchar* row = m_coverage.scanLine(y);
+            const float dy = y + 0.5f - centerY;
+            for (int x = 0; x < extent; ++x) {
+                const float dx = x + 0.5f - centerX;
+                const float distance = std::sqrt(dx * dx + dy * dy);
+                // Antialiased edge over the pixel the radius crosses
+                float coverage = std::clamp(radius - distance + 0.5f, 0.0f, 1.0f);
+                if (falloff > 0.0f && distance > inner) {
+                    coverage *= std::max(0.0f, 1.0f - (distance - inner) / falloff);
+                }
+                row[x] = static_cast<uchar>(coverage * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    QPoint BrushStamp::topLeft(const QPointF& center) const
+    {
+        return QPoint(static_cast<int>(std::floor(center.x())) - m_margin,
+                      static_cast<int>(std::floor(center.y())) - m_margin);
+    }
+
+    BrushStampCache::BrushStampCache(qint64 budget)
+        : m_budget(budget)
+        , m_memory(0)
+        , m_useCounter(0)
+    {
+    }
+
+    std::shared_ptr<const BrushStamp> BrushStampCache::get(int size, float hardness, const QPointF& center)
+    {
+        int phaseX = 0;
+        int phaseY = 0;
+        if (size <= SubpixelMaxSize) {
+            phaseX = static_cast<int>((center.x() - std::floor(center.x())) * SubpixelSteps);
+            phaseY = static_cast<int>((center.y() - std::floor(center.y())) * SubpixelSteps);
+        }
+        const Key key(size, static_cast<int>(std::clamp(hardness, 0.0f, 1.0f) * 255.0f + 0.5f), phaseX, phaseY);
+
+        auto it = m_stamps.find(key);
+        if (it == m_stamps.end()) {
+            const QPointF phase(static_cast<qreal>(phaseX) / SubpixelSteps, static_cast<qreal>(phaseY) / SubpixelSteps);
+            auto stamp = std::make_shared<BrushStamp>(size, std::get<1>(key) / 255.0f, phase);
+            const qint64 bytes = stamp->getCoverage().sizeInBytes();
+            m_memory += bytes;
+            it = m_stamps.emplace(key, Entry{ stamp, bytes, 0 }).first;
+            evict();
+        }
+        it->second.lastUse = ++m_useCounter;
+        return it->second.stamp;
+    }
+
+    void BrushStampCache::clear()
+    {
+        m_stamps.clear();
+        m_memory = 0;
+    }
+
+    void BrushStampCache::evict()
+    {
+        // The newest stamp always stays, however large
+        while (m_memory > m_budget && m_stamps.size() > 1) {
+            auto oldest = m_stamps.end();
+            for (auto it = m_stamps.begin(); it != m_stamps.end(); ++it) {
+                if (it->second.lastUse == 0) continue;
+                if (oldest == m_stamps.end() || it->second.lastUse < oldest->second.lastUse) {
+                    oldest = it;
+                }
+            }
+            if (oldest == m_stamps.end()) break;
+            m_memory -= oldest->second.bytes;
+            m_stamps.erase(oldest);
+        }
+    }
+
+} // namespace LibreCanvas
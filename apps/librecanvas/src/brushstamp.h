@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QImage>
+#include <QPoint>
+#include <QPointF>
+#include <map>
+#include <memory>
+#include <tuple>
+
+namespace LibreCanvas {
+
+    // Coverage of one round dab, rasterized once and reused for every dab
+    // with the same size, hardness and subpixel offset. Coverage is
+    // Format_Alpha8; 255 is the full brush color, and soft brushes fall off
+    // linearly from hardness times the radius to the edge. Color and opacity
+    // are applied by the dab kernels while compositing.
+    class BrushStamp {
+    public:
+        BrushStamp(int size, float hardness, const QPointF& phase);
+
+        const QImage& getCoverage() const { return m_coverage; }
+        // Where the stamp's top-left pixel goes for a dab centred on center
+        QPoint topLeft(const QPointF& center) const;
+
+    private:
+        // Padding in pixels between the stamp edge and the dab's radius
+        int m_margin;
+        QImage m_coverage;
+    };
+
+    // Stamps by size, hardness and subpixel offset, least recently used
+    // dropped first once their memory passes the budget. Brushes up to
+    // SubpixelMaxSize get SubpixelSteps offsets per axis; on larger ones
+    // the difference cannot be seen.
+    class BrushStampCache {
+    public:
+        static constexpr int SubpixelSteps = 4;
+        static constexpr int SubpixelMaxSize = 64;
+        static constexpr qint64 DefaultBudget = qint64(64) * 1024 * 1024;
+
+        explicit BrushStampCache(qint64 budget = DefaultBudget);
+
+        std::shared_ptr<const BrushStamp> get(int size, float hardness, const QPointF& center);
+
+        void clear();
+        qint64 getMemory() const { return m_memory; }
+
+    private:
+        // Size, hardness in 1/255 steps and the subpixel offset
+        using Key = std::tuple<int, int, int, int>;
+        struct Entry {
+            std::shared_ptr<const BrushStamp> stamp;
+            qint64 bytes;
+            quint64 lastUse;
+        };
+
+        void evict();
+
+        std::map<Key, Entry> m_stamps;
+        qint64 m_budget;
+        qint64 m_memory;
+        quint64 m_useCounter;
+    };
+
+} // namespace LibreCanvas
@@ -11,12 +11,27 @@
 #include <QPen>
 #include <QBrush>
 #include <QApplication>
+#include <QThread>
+#include <QScreen>
+#include <cmath>
 
 CanvasWidget::CanvasWidget(QWidget *parent)
     : QWidget(parent)
     , m_document(nullptr)
+    , m_pixmapZoom(1.0f)
     , m_zoomLevel(1.0f)
     , m_isPanning(false)
+    , m_documentSerial(0)
+    , m_lastFrameTime(0)
+    , m_renderPending(false)
+    , m_repaintPending(false)
+    , m_pendingInputTime(-1)
+    , m_deliveredInputTime(-1)
+    , m_requestSerial(0)
+    , m_completedSerial(0)
+    , m_periodStart(0)
+    , m_latencySum(0.0)
+    , m_latencySamples(0)
 {
     setMinimumSize(400, 300);
     setMouseTracking(true);
@@ -25,8 +40,37 @@ CanvasWidget::CanvasWidget(QWidget *parent)
     // Set background pattern for transparency
     setStyleSheet("background-color: #2a2a2a;");
     
+    // paintEvent covers every exposed pixel with the checkerboard
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    m_checkerboard = QPixmap(CheckerSize * 2, CheckerSize * 2);
+    QPainter checkerPainter(&m_checkerboard);
+    checkerPainter.fillRect(m_checkerboard.rect(), QColor(50, 50, 50));
+    checkerPainter.fillRect(0, 0, CheckerSize, CheckerSize, QColor(60, 60, 60));
+    checkerPainter.fillRect(CheckerSize, CheckerSize, CheckerSize, CheckerSize, QColor(60, 60, 60));
+    checkerPainter.end();
+    
     // Set default tool (Brush)
     m_currentTool = std::make_shared<LibreCanvas::BrushTool>();
+    
+    qRegisterMetaType<LibreCanvas::RenderResult>();
+    m_renderThread = new QThread(this);
+    m_renderWorker = new LibreCanvas::RenderWorker;
+    m_renderWorker->moveToThread(m_renderThread);
+    connect(m_renderThread, &QThread::finished, m_renderWorker, &QObject::deleteLater);
+    connect(m_renderWorker, &LibreCanvas::RenderWorker::tilesReady, this, &CanvasWidget::onTilesReady);
+    m_renderThread->start();
+    
+    m_frameClock.start();
+    m_frameTimer = new QTimer(this);
+    m_frameTimer->setSingleShot(true);
+    m_frameTimer->setTimerType(Qt::PreciseTimer);
+    connect(m_frameTimer, &QTimer::timeout, this, &CanvasWidget::presentFrame);
+}
+
+CanvasWidget::~CanvasWidget()
+{
+    m_renderThread->quit();
+    m_renderThread->wait();
 }
 
 bool CanvasWidget::loadImage(const QString &filePath)
@@ -38,12 +82,22 @@ bool CanvasWidget::loadImage(const QString &filePath)
         return false;
     }
     
+    // Keep the precision of 16-bit and float files
+    LibreCanvas::PixelDepth depth = LibreCanvas::PixelDepth::Uint8;
+    if (loadedImage.pixelFormat().typeInterpretation() == QPixelFormat::FloatingPoint) {
+        depth = LibreCanvas::PixelDepth::Float32;
+    } else if (loadedImage.depth() == 64) {
+        depth = LibreCanvas::PixelDepth::Uint16;
+    }
+
     // Create document with loaded image
-    m_document = std::make_shared<LibreCanvas::Document>(loadedImage.width(), loadedImage.height());
+    m_document = std::make_shared<LibreCanvas::Document>(loadedImage.width(), loadedImage.height(), Qt::white, depth);
+    documentReplaced();
     if (m_historyManager) {
         m_document->setHistoryManager(m_historyManager.get());
     }
-    auto layer = std::make_shared<LibreCanvas::Layer>("Layer 1", loadedImage);
+    // Everything internal is premultiplied; convert once at import
+    auto layer = std::make_shared<LibreCanvas::Layer>("Layer 1", loadedImage.convertToFormat(m_document->getImageFormat()));
     m_document->addLayer(layer);
     m_document->saveState("Load Image");
     
@@ -69,7 +123,8 @@ bool CanvasWidget::saveImage(const QString &filePath)
         format = "PNG";
     }
     
-    QImage rendered = m_document->render();
+    // Image writers expect straight alpha; convert once at export
+    QImage rendered = m_document->render().convertToFormat(LibreCanvas::exportFormat(m_document->getPixelDepth()));
     if (!rendered.save(filePath, format.toLatin1().constData())) {
         QMessageBox::warning(this, "Save Error", 
             QString("Failed to save image:\n%1").arg(filePath));
@@ -79,12 +134,14 @@ bool CanvasWidget::saveImage(const QString &filePath)
     return true;
 }
 
-void CanvasWidget::newImage(int width, int height)
+void CanvasWidget::newImage(int width, int height, LibreCanvas::PixelDepth depth)
 {
-    m_document = std::make_shared<LibreCanvas::Document>(width, height, Qt::white);
+    m_document = std::make_shared<LibreCanvas::Document>(width, height, Qt::white, depth);
+    documentReplaced();
     if (m_historyManager) {
         m_document->setHistoryManager(m_historyManager.get());
     }
+    m_document->saveState("New Image");
     m_zoomLevel = 1.0f;
     m_panDelta = QPoint(0, 0);
     updatePixmap();
@@ -97,6 +154,7 @@ void CanvasWidget::newImage(int width, int height)
 void CanvasWidget::setDocument(std::shared_ptr<LibreCanvas::Document> document)
 {
     m_document = document;
+    documentReplaced();
     if (m_document && m_historyManager) {
         m_document->setHistoryManager(m_historyManager.get());
     }
@@ -162,23 +220,22 @@ void CanvasWidget::paintEvent(QPaintEvent *event)
     QPainter painter(this);
     painter.setRenderHint(QPainter::Antialiasing);
     
-    // Draw checkerboard pattern for transparency
-    QColor color1(60, 60, 60);
-    QColor color2(50, 50, 50);
-    int tileSize = 20;
+    // Only the damaged part of the widget is repainted; the painter clips
+    // to it, and the blits below are limited to it as well
+    const QRect exposed = event->rect();
     
-    for (int y = 0; y < height(); y += tileSize) {
-        for (int x = 0; x < width(); x += tileSize) {
-            QColor color = ((x / tileSize) + (y / tileSize)) % 2 == 0 ? color1 : color2;
-            painter.fillRect(x, y, tileSize, tileSize, color);
-        }
-    }
+    // Draw checkerboard pattern for transparency, anchored to the widget
+    const int period = CheckerSize * 2;
+    painter.drawTiledPixmap(exposed, m_checkerboard, QPoint(exposed.x() % period, exposed.y() % period));
     
     // Draw document if available
-    if (m_document && !m_pixmap.isNull()) {
-        QSize scaledSize = m_pixmap.size();
-        QPoint drawPos = (rect().center() - QRect(0, 0, scaledSize.width(), scaledSize.height()).center()) + m_panDelta;
-        painter.drawPixmap(drawPos, m_pixmap);
+    if (m_document) {
+        if (!m_pixmap.isNull()) {
+            QRect target = QRect(imageTopLeft() + m_pixmapRect.topLeft(), m_pixmap.size()).intersected(exposed);
+            if (!target.isEmpty()) {
+                painter.drawPixmap(target, m_pixmap, target.translated(-imageTopLeft() - m_pixmapRect.topLeft()));
+            }
+        }
         
         // Draw selection overlay
         drawSelection(painter);
@@ -188,6 +245,8 @@ void CanvasWidget::paintEvent(QPaintEvent *event)
         painter.setFont(QFont("Arial", 14));
         painter.drawText(rect(), Qt::AlignCenter, "No image loaded\n\nFile → New or File → Open");
     }
+    
+    recordPaintedFrame();
 }
 
 void CanvasWidget::drawSelection(QPainter& painter)
@@ -280,6 +339,12 @@ void CanvasWidget::drawSelection(QPainter& painter)
     }
 }
 
+void CanvasWidget::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    ensureViewportCovered();
+}
+
 void CanvasWidget::wheelEvent(QWheelEvent *event)
 {
     if (!m_document) return;
@@ -303,14 +368,16 @@ void CanvasWidget::mousePressEvent(QMouseEvent *event)
     
     // Handle tool
     if (m_currentTool && m_document && event->button() == Qt::LeftButton) {
+        // Tiles are saved as the tool first writes them, so the stroke
+        // starts right away and undo returns to exactly this state
+        if (!m_currentTool->recordsHistory()) {
+            m_document->beginEdit();
+        }
         QPoint imagePos = canvasToImage(event->pos());
+        m_currentTool->setImagePosition(canvasToImage(event->position()));
         m_currentTool->onMousePress(event, m_document, imagePos);
-        // Save state before tool operation
-        if (m_historyManager && m_document) {
-            m_historyManager->pushState(m_document, "Tool Operation");
-        }
-        updatePixmap();
-        update();
+        refreshPixmap();
+        updateToolOverlay();
     }
 }
 
@@ -320,16 +387,18 @@ void CanvasWidget::mouseMoveEvent(QMouseEvent *event)
         QPoint delta = event->pos() - m_panStart;
         m_panDelta += delta;
         m_panStart = event->pos();
-        update();
+        m_repaintPending = true;
+        scheduleFrame();
         return;
     }
     
     // Handle tool
     if (m_currentTool && m_document && event->buttons() & Qt::LeftButton) {
         QPoint imagePos = canvasToImage(event->pos());
+        m_currentTool->setImagePosition(canvasToImage(event->position()));
         m_currentTool->onMouseMove(event, m_document, imagePos);
-        updatePixmap();
-        update();
+        refreshPixmap();
+        updateToolOverlay();
     }
 }
 
@@ -343,9 +412,11 @@ void CanvasWidget::mouseReleaseEvent(QMouseEvent *event)
     // Handle tool
     if (m_currentTool && m_document && event->button() == Qt::LeftButton) {
         QPoint imagePos = canvasToImage(event->pos());
+        m_currentTool->setImagePosition(canvasToImage(event->position()));
         m_currentTool->onMouseRelease(event, m_document, imagePos);
-        updatePixmap();
-        update();
+        m_document->endEdit("Tool Operation");
+        refreshPixmap();
+        updateToolOverlay();
         emit imageChanged();
     }
 }
@@ -374,19 +445,216 @@ void CanvasWidget::setTool(std::shared_ptr<LibreCanvas::Tool> tool)
     }
 }
 
+void CanvasWidget::documentReplaced()
+{
+    // Tiles still on their way for the previous document are dropped
+    ++m_documentSerial;
+    m_pixmap = QPixmap();
+    // Steps of the previous document can neither be undone into this one
+    // nor hold budget it needs
+    if (m_historyManager) {
+        m_historyManager->clear();
+    }
+}
+
 void CanvasWidget::updatePixmap()
 {
     if (!m_document) {
         m_pixmap = QPixmap();
+        m_pixmapRect = QRect();
         return;
     }
     
-    QImage rendered = m_document->render();
-    QSize scaledSize = rendered.size() * m_zoomLevel;
-    m_pixmap = QPixmap::fromImage(rendered.scaled(scaledSize, Qt::KeepAspectRatio, Qt::SmoothTransformation));
+    // Only the part of the zoomed image around the viewport is kept, so
+    // memory and latency follow the widget size rather than the document's
+    QRect viewRect = visibleZoomedRect(ViewportMargin);
+    if (viewRect.isEmpty()) {
+        m_pixmap = QPixmap();
+        m_pixmapRect = viewRect;
+        update();
+        return;
+    }
+    
+    // Until the render thread delivers, show the old pixmap moved or
+    // stretched into place as a quick preview
+    QPixmap pixmap(viewRect.size());
+    pixmap.fill(Qt::transparent);
+    if (!m_pixmap.isNull()) {
+        const float factor = m_zoomLevel / m_pixmapZoom;
+        QRectF oldRect(m_pixmapRect.x() * factor, m_pixmapRect.y() * factor,
+                       m_pixmapRect.width() * factor, m_pixmapRect.height() * factor);
+        QPainter painter(&pixmap);
+        painter.drawPixmap(oldRect.translated(-viewRect.topLeft()), m_pixmap, QRectF(m_pixmap.rect()));
+        painter.end();
+    }
+    m_pixmap = pixmap;
+    m_pixmapRect = viewRect;
+    m_pixmapZoom = m_zoomLevel;
+    
+    requestRender(true);
     update();
 }
 
+void CanvasWidget::refresh()
+{
+    m_repaintPending = true;
+    refreshPixmap();
+}
+
+void CanvasWidget::refreshPixmap()
+{
+    if (!m_document) return;
+    if (m_pendingInputTime < 0) {
+        m_pendingInputTime = m_frameClock.nsecsElapsed();
+    }
+    m_renderPending = true;
+    scheduleFrame();
+}
+
+void CanvasWidget::scheduleFrame()
+{
+    if (m_frameTimer->isActive()) return;
+    
+    // The first change after an idle spell goes out at once; changes that
+    // keep coming are held until the next frame is due
+    const qint64 sinceLastFrame = (m_frameClock.nsecsElapsed() - m_lastFrameTime) / 1000000;
+    m_frameTimer->start(static_cast<int>(qMax<qint64>(0, frameInterval() - sinceLastFrame)));
+}
+
+void CanvasWidget::presentFrame()
+{
+    m_lastFrameTime = m_frameClock.nsecsElapsed();
+    
+    if (m_repaintPending) {
+        m_repaintPending = false;
+        ensureViewportCovered();
+        update();
+    }
+    
+    if (m_renderPending) {
+        m_renderPending = false;
+        if (!m_document) return;
+        // The last frame's render has not come back; this frame shows nothing new
+        if (m_completedSerial != m_requestSerial) {
+            ++m_periodStats.droppedFrames;
+        }
+        if (m_pixmap.isNull()) {
+            updatePixmap();
+        } else {
+            requestRender(false);
+        }
+    }
+}
+
+int CanvasWidget::frameInterval() const
+{
+    const qreal rate = screen() ? screen()->refreshRate() : 0.0;
+    return rate > 0.0 ? qMax(1, qRound(1000.0 / rate)) : 16;
+}
+
+void CanvasWidget::recordPaintedFrame()
+{
+    const qint64 now = m_frameClock.nsecsElapsed();
+    ++m_periodStats.frames;
+    if (m_deliveredInputTime >= 0) {
+        const double latency = (now - m_deliveredInputTime) / 1e6;
+        m_latencySum += latency;
+        ++m_latencySamples;
+        m_periodStats.maxLatencyMs = qMax(m_periodStats.maxLatencyMs, latency);
+        m_deliveredInputTime = -1;
+    }
+    
+    if (now - m_periodStart < StatsPeriodNs) return;
+    
+    m_periodStats.refreshRate = 1000.0 / frameInterval();
+    m_periodStats.averageLatencyMs = m_latencySamples > 0 ? m_latencySum / m_latencySamples : 0.0;
+    m_frameStats = m_periodStats;
+    m_periodStats = FrameStats();
+    m_periodStart = now;
+    m_latencySum = 0.0;
+    m_latencySamples = 0;
+    emit frameStatsUpdated(m_frameStats);
+}
+
+void CanvasWidget::requestRender(bool fullView)
+{
+    // Taking the snapshot only bumps tile reference counts; the render
+    // thread never touches the document itself
+    LibreCanvas::RenderRequest request;
+    request.snapshot = m_document->takeSnapshot();
+    request.zoom = m_zoomLevel;
+    request.viewRect = m_pixmapRect;
+    request.fullView = fullView;
+    request.documentSerial = m_documentSerial;
+    request.requestSerial = ++m_requestSerial;
+    request.inputTime = m_pendingInputTime;
+    m_pendingInputTime = -1;
+    m_renderWorker->submit(std::move(request));
+}
+
+void CanvasWidget::onTilesReady(const LibreCanvas::RenderResult &result)
+{
+    if (result.requestSerial != 0) {
+        m_completedSerial = qMax(m_completedSerial, result.requestSerial);
+    }
+    
+    // Tiles for a view or document that has since been replaced are stale
+    if (!m_document || m_pixmap.isNull() || result.documentSerial != m_documentSerial ||
+        result.zoom != m_zoomLevel || result.viewRect != m_pixmapRect) {
+        return;
+    }
+    
+    QRegion damage;
+    QPainter painter(&m_pixmap);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for (const LibreCanvas::RenderTile &tile : result.tiles) {
+        painter.drawImage(tile.rect.topLeft() - m_pixmapRect.topLeft(), tile.image);
+        damage += tile.rect;
+    }
+    painter.end();
+    if (damage.isEmpty()) return;
+    
+    // Latency is measured to the paint that shows these tiles
+    if (result.inputTime >= 0 && (m_deliveredInputTime < 0 || result.inputTime < m_deliveredInputTime)) {
+        m_deliveredInputTime = result.inputTime;
+    }
+    update(damage.translated(imageTopLeft()));
+}
+
+void CanvasWidget::updateToolOverlay()
+{
+    // Selection and transform overlays move with the mouse anywhere on the
+    // canvas; painted pixels are repainted when their tiles come back
+    LibreCanvas::ToolType type = m_currentTool->getType();
+    if (type == LibreCanvas::ToolType::MarqueeRect || type == LibreCanvas::ToolType::Transform) {
+        m_repaintPending = true;
+        scheduleFrame();
+    }
+}
+
+void CanvasWidget::ensureViewportCovered()
+{
+    if (!m_document) return;
+    if (!m_pixmapRect.contains(visibleZoomedRect(0))) {
+        updatePixmap();
+    }
+}
+
+QRect CanvasWidget::visibleZoomedRect(int margin) const
+{
+    // The widget area, in pixels of the zoomed image
+    QSize scaledSize = m_document->getSize() * m_zoomLevel;
+    QRect visible = rect().adjusted(-margin, -margin, margin, margin).translated(-imageTopLeft());
+    return visible.intersected(QRect(QPoint(0, 0), scaledSize));
+}
+
+QPoint CanvasWidget::imageTopLeft() const
+{
+    QSize scaledSize = m_document->getSize() * m_zoomLevel;
+    QPoint canvasCenter = rect().center() + m_panDelta;
+    return canvasCenter - QPoint(scaledSize.width() / 2, scaledSize.height() / 2);
+}
+
 QImage CanvasWidget::getImage() const
 {
     if (!m_document) {
@@ -420,3 +688,11 @@ QPoint CanvasWidget::canvasToImage(const QPoint &point) const
     return QPoint(relativePoint.x() / m_zoomLevel, relativePoint.y() / m_zoomLevel);
 }
 
+QPointF CanvasWidget::canvasToImage(const QPointF &point) const
+{
+    if (!m_document) return point;
+
+    // Unrounded, for tools that place marks between pixels
+    return (point - QPointF(imageTopLeft())) / m_zoomLevel;
+}
+
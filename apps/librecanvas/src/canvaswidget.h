@@ -7,22 +7,40 @@
 #include <QWheelEvent>
 #include <QMouseEvent>
 #include <QKeyEvent>
+#include <QResizeEvent>
 #include <QPoint>
+#include <QTimer>
+#include <QElapsedTimer>
 #include <memory>
 #include "document.h"
+#include "renderworker.h"
 #include "tool.h"
 
+// Canvas frame timing over the last reporting period, for diagnostics
+struct FrameStats {
+    // Display refresh rate that canvas updates are paced to, in Hz
+    double refreshRate = 0.0;
+    int frames = 0;
+    // Frame ticks that found new input while the previous render was still
+    // in flight
+    int droppedFrames = 0;
+    // From the first input folded into a frame until its pixels are painted
+    double averageLatencyMs = 0.0;
+    double maxLatencyMs = 0.0;
+};
+
 class CanvasWidget : public QWidget
 {
     Q_OBJECT
 
 public:
     explicit CanvasWidget(QWidget *parent = nullptr);
+    ~CanvasWidget() override;
     
     // Document operations
     bool loadImage(const QString &filePath);
     bool saveImage(const QString &filePath);
-    void newImage(int width, int height);
+    void newImage(int width, int height, LibreCanvas::PixelDepth depth = LibreCanvas::PixelDepth::Uint8);
     
     // Document access
     std::shared_ptr<LibreCanvas::Document> getDocument() { return m_document; }
@@ -37,10 +55,14 @@ public:
     void resetZoom();
     void fitToWindow();
     
+    // Recomposite whatever changed in the document and repaint
+    void refresh();
+    
     // Getters
     QImage getImage() const;
     float getZoomLevel() const { return m_zoomLevel; }
     bool hasImage() const { return m_document != nullptr; }
+    const FrameStats& getFrameStats() const { return m_frameStats; }
 
     // Tool management
     void setTool(std::shared_ptr<LibreCanvas::Tool> tool);
@@ -50,9 +72,12 @@ signals:
     void imageChanged();
     void zoomChanged(float zoom);
     void documentChanged();
+    // Emitted about once a second while the canvas is repainting
+    void frameStatsUpdated(const FrameStats &stats);
 
 protected:
     void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
     void wheelEvent(QWheelEvent *event) override;
     void mousePressEvent(QMouseEvent *event) override;
     void mouseMoveEvent(QMouseEvent *event) override;
@@ -60,19 +85,73 @@ protected:
     void keyPressEvent(QKeyEvent *event) override;
     void keyReleaseEvent(QKeyEvent *event) override;
 
+private slots:
+    void onTilesReady(const LibreCanvas::RenderResult &result);
+
 private:
     std::shared_ptr<LibreCanvas::Document> m_document;
     std::shared_ptr<LibreCanvas::Tool> m_currentTool;
     std::shared_ptr<LibreCanvas::HistoryManager> m_historyManager;
+    // Scaled copy of the visible part of the document; m_pixmapRect is the
+    // area it covers, in pixels of the zoomed image
     QPixmap m_pixmap;
+    QRect m_pixmapRect;
+    float m_pixmapZoom;
+    // Two by two squares of the transparency checkerboard, tiled under the
+    // exposed area on every repaint
+    QPixmap m_checkerboard;
     float m_zoomLevel;
     QPoint m_panStart;
     QPoint m_panDelta;
     bool m_isPanning;
     
+    // Extra widget pixels kept around the viewport so small pans are free
+    static constexpr int ViewportMargin = 128;
+    static constexpr int CheckerSize = 20;
+    
+    // Compositing and scaling run on this thread; the GUI thread only
+    // sends snapshots and draws the tiles that come back
+    QThread *m_renderThread;
+    LibreCanvas::RenderWorker *m_renderWorker;
+    quint64 m_documentSerial;
+    
+    // Tools run at the full input rate, but renders and repaints are
+    // collected and sent at most once per display frame
+    QTimer *m_frameTimer;
+    QElapsedTimer m_frameClock;
+    qint64 m_lastFrameTime;
+    bool m_renderPending;
+    bool m_repaintPending;
+    // Oldest input not yet sent to the render thread, and oldest input whose
+    // tiles came back but are not painted yet; -1 when there is none
+    qint64 m_pendingInputTime;
+    qint64 m_deliveredInputTime;
+    quint64 m_requestSerial;
+    quint64 m_completedSerial;
+    
+    FrameStats m_frameStats;
+    FrameStats m_periodStats;
+    qint64 m_periodStart;
+    double m_latencySum;
+    int m_latencySamples;
+    
+    static constexpr qint64 StatsPeriodNs = 1000000000;
+    
+    void documentReplaced();
     void updatePixmap();
+    void refreshPixmap();
+    void requestRender(bool fullView);
+    void scheduleFrame();
+    void presentFrame();
+    int frameInterval() const;
+    void recordPaintedFrame();
+    void updateToolOverlay();
+    void ensureViewportCovered();
+    QRect visibleZoomedRect(int margin) const;
+    QPoint imageTopLeft() const;
     QPoint imageToCanvas(const QPoint &point) const;
     QPoint canvasToImage(const QPoint &point) const;
+    QPointF canvasToImage(const QPointF &point) const;
     void drawSelection(QPainter& painter);
 };
 
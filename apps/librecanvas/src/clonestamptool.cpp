@@ -14,7 +14,7 @@ namespace LibreCanvas {
         if (event->modifiers() & Qt::AltModifier) {
             // Set source point and capture source image
             m_sourcePoint = imagePos;
-            m_sourceImage = activeLayer->getImage().copy();
+            m_sourceImage = activeLayer->getImage();
             m_sourceSet = true;
             return;
         }
@@ -22,19 +22,18 @@ namespace LibreCanvas {
         if (!m_sourceSet) {
             // Default to same point if source not set
             m_sourcePoint = imagePos;
-            m_sourceImage = activeLayer->getImage().copy();
+            m_sourceImage = activeLayer->getImage();
             m_sourceSet = true;
         }
         
         m_isCloning = true;
         m_lastDestPos = imagePos;
         
-        QImage& layerImage = activeLayer->getImage();
-        QPainter painter(&layerImage);
-        painter.setRenderHint(QPainter::Antialiasing);
-        
-        cloneBrush(painter, m_sourceImage, m_sourcePoint, imagePos, m_size, m_hardness, m_opacity);
-        painter.end();
+        QRect layerRect = activeLayer->getSurface().rect();
+        activeLayer->paint(dabBounds(imagePos, imagePos, m_size), [&](QPainter& painter) {
+            painter.setRenderHint(QPainter::Antialiasing);
+            cloneBrush(painter, layerRect, m_sourceImage, m_sourcePoint, imagePos, m_size, m_hardness, m_opacity);
+        });
         
         // Note: History is saved in canvas widget before tool operation
     }
@@ -46,18 +45,17 @@ namespace LibreCanvas {
         auto activeLayer = doc->getActiveLayer();
         if (!activeLayer || activeLayer->isLocked()) return;
         
-        QImage& layerImage = activeLayer->getImage();
-        QPainter painter(&layerImage);
-        painter.setRenderHint(QPainter::Antialiasing);
-        
         // Calculate offset
         QPoint offset = imagePos - m_lastDestPos;
         m_sourcePoint += offset;
         
-        cloneBrush(painter, m_sourceImage, m_sourcePoint, imagePos, m_size, m_hardness, m_opacity);
+        QRect layerRect = activeLayer->getSurface().rect();
+        activeLayer->paint(dabBounds(imagePos, imagePos, m_size), [&](QPainter& painter) {
+            painter.setRenderHint(QPainter::Antialiasing);
+            cloneBrush(painter, layerRect, m_sourceImage, m_sourcePoint, imagePos, m_size, m_hardness, m_opacity);
+        });
         
         m_lastDestPos = imagePos;
-        painter.end();
     }
 
     void CloneStampTool::onMouseRelease(QMouseEvent *event, std::shared_ptr<Document> doc, const QPoint& imagePos)
@@ -65,7 +63,7 @@ namespace LibreCanvas {
         m_isCloning = false;
     }
 
-    void CloneStampTool::cloneBrush(QPainter& painter, const QImage& sourceImage, const QPoint& sourcePos, const QPoint& destPos, int size, float hardness, float opacity)
+    void CloneStampTool::cloneBrush(QPainter& painter, const QRect& destBounds, const QImage& sourceImage, const QPoint& sourcePos, const QPoint& destPos, int size, float hardness, float opacity)
     {
         
         QRect sourceRect(sourcePos.x() - size/2, sourcePos.y() - size/2, size, size);
@@ -73,7 +71,7 @@ namespace LibreCanvas {
         
         // Clamp source rect to image bounds
         sourceRect = sourceRect.intersected(QRect(0, 0, sourceImage.width(), sourceImage.height()));
-        destRect = destRect.intersected(QRect(0, 0, painter.device()->width(), painter.device()->height()));
+        destRect = destRect.intersected(destBounds);
         
         if (sourceRect.isEmpty() || destRect.isEmpty()) return;
         
@@ -20,7 +20,7 @@ namespace LibreCanvas {
         void setOpacity(float opacity) { m_opacity = qBound(0.0f, opacity, 1.0f); }
 
     private:
-        void cloneBrush(QPainter& painter, const QImage& sourceImage, const QPoint& sourcePos, const QPoint& destPos, int size, float hardness, float opacity);
+        void cloneBrush(QPainter& painter, const QRect& destBounds, const QImage& sourceImage, const QPoint& sourcePos, const QPoint& destPos, int size, float hardness, float opacity);
         
         int m_size = 20;
         float m_hardness = 1.0f;
@@ -0,0 +1,468 @@
+#include "compositor.h"
+#include "pixeldepth.h"
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+
+namespace LibreCanvas {
+
+    static_assert(static_cast<int>(BlendMode::Exclusion) == static_cast<int>(LibreEffects::Core::BlendMode::Exclusion),
+                  "Layer blend modes must match the core kernel order");
+
+    static LibreEffects::Core::BlendMode toCoreBlendMode(BlendMode mode)
+    {
+        return static_cast<LibreEffects::Core::BlendMode>(mode);
+    }
+
+    Compositor::Buffer::Buffer(QImage& image)
+        : bits(image.bits())
+        , bytesPerLine(image.bytesPerLine())
+        , format(image.format())
+        , bytesPerPixel(image.depth() / 8)
+    {
+    }
+
+    QImage Compositor::Buffer::view(const QRect& rect) const
+    {
+        return QImage(bits + rect.y() * bytesPerLine + rect.x() * bytesPerPixel,
+                      rect.width(), rect.height(), bytesPerLine, format);
+    }
+
+    Compositor::Compositor()
+        : m_multithreaded(true)
+        , m_blendSpace(LibreEffects::Core::BlendSpace::Srgb)
+        , m_cachedActive(-1)
+        , m_aboveFlattened(false)
+    {
+    }
+
+    void Compositor::composite(QImage& target, const QRegion& region, const QColor& background,
+                               const std::vector<std::shared_ptr<Layer>>& layers,
+                               const std::vector<std::shared_ptr<LayerGroup>>& groups) const
+    {
+        const QRegion clipped = region.intersected(target.rect());
+        std::vector<QRect> pieces = splitIntoTiles(clipped);
+        if (pieces.empty()) return;
+
+        updateGroupCaches(groups, clipped, target.rect(), target.format());
+
+        // Detach once up front; workers then paint through views that share
+        // this buffer but never overlap
+        const Buffer buffer(target);
+
+        auto compositePiece = [&](const QRect& piece) {
+            QImage view = buffer.view(piece);
+            compositeTile(view, piece, background, layers, groups);
+        };
+
+        if (m_multithreaded && pieces.size() > 1) {
+            QtConcurrent::blockingMap(pieces, compositePiece);
+        } else {
+            for (const QRect& piece : pieces) {
+                compositePiece(piece);
+            }
+        }
+    }
+
+    void Compositor::compositeAround(QImage& target, const QRegion& region, const QColor& background,
+                                     const std::vector<std::shared_ptr<Layer>>& layers, int activeIndex,
+                                     const std::vector<std::shared_ptr<LayerGroup>>& groups)
+    {
+        if (activeIndex < 0 || activeIndex >= static_cast<int>(layers.size())) {
+            composite(target, region, background, layers, groups);
+            return;
+        }
+
+        // Anything that reorders the stack or moves the active layer
+        // invalidates both caches
+        std::vector<const Layer*> stack;
+        stack.reserve(layers.size());
+        for (const auto& layer : layers) {
+            stack.push_back(layer.get());
+        }
+        if (m_belowCache.size() != target.size() || m_belowCache.format() != target.format()) {
+            m_belowCache = QImage(target.size(), target.format());
+            m_aboveCache = QImage(target.size(), target.format());
+            invalidateCaches();
+        }
+        if (stack != m_cachedStack || activeIndex != m_cachedActive || background != m_cachedBackground) {
+            m_cachedStack = std::move(stack);
+            m_cachedActive = activeIndex;
+            m_cachedBackground = background;
+            invalidateCaches();
+        }
+
+        // Source-over is associative, so Normal layers can be flattened on
+        // their own and blended as one; other modes need the real backdrop
+        const bool flattenAbove = canFlattenAbove(layers, activeIndex, groups);
+        if (flattenAbove != m_aboveFlattened) {
+            m_aboveFlattened = flattenAbove;
+            m_aboveValid = QRegion();
+        }
+
+        const QRegion clipped = region.intersected(target.rect());
+        std::vector<QRect> pieces = splitIntoTiles(clipped);
+        if (pieces.empty()) return;
+
+        // Groups sit above every layer, so they only feed the above side
+        QRegion groupRegion;
+        for (const QRect& rect : pieces) {
+            if (!flattenAbove || !QRegion(rect).subtracted(m_aboveValid).isEmpty()) {
+                groupRegion += rect;
+            }
+        }
+        updateGroupCaches(groups, groupRegion, target.rect(), target.format());
+
+        struct Piece {
+            QRect rect;
+            bool fillBelow;
+            bool fillAbove;
+        };
+        std::vector<Piece> work;
+        work.reserve(pieces.size());
+        for (const QRect& rect : pieces) {
+            const QRegion area(rect);
+            work.push_back({ rect,
+                             !area.subtracted(m_belowValid).isEmpty(),
+                             flattenAbove && !area.subtracted(m_aboveValid).isEmpty() });
+        }
+
+        const Buffer buffer(target);
+        const Buffer below(m_belowCache);
+        const Buffer above(m_aboveCache);
+        const int layerCount = static_cast<int>(layers.size());
+
+        auto compositePiece = [&](const Piece& piece) {
+            QImage belowView = below.view(piece.rect);
+            if (piece.fillBelow) {
+                belowView.fill(background);
+                blendLayers(belowView, piece.rect, layers, 0, activeIndex);
+            }
+
+            QImage aboveView = above.view(piece.rect);
+            if (piece.fillAbove) {
+                aboveView.fill(Qt::transparent);
+                blendLayers(aboveView, piece.rect, layers, activeIndex + 1, layerCount);
+                blendGroups(aboveView, piece.rect, groups);
+            }
+
+            QImage view = buffer.view(piece.rect);
+            copyPixels(view, belowView);
+            blendLayers(view, piece.rect, layers, activeIndex, activeIndex + 1);
+            if (flattenAbove) {
+                blendImage(view, aboveView);
+            } else {
+                blendLayers(view, piece.rect, layers, activeIndex + 1, layerCount);
+                blendGroups(view, piece.rect, groups);
+            }
+        };
+
+        if (m_multithreaded && work.size() > 1) {
+            QtConcurrent::blockingMap(work, compositePiece);
+        } else {
+            for (const Piece& piece : work) {
+                compositePiece(piece);
+            }
+        }
+
+        for (const Piece& piece : work) {
+            m_belowValid += piece.rect;
+            if (flattenAbove) {
+                m_aboveValid += piece.rect;
+            }
+        }
+    }
+
+    void Compositor::setBlendSpace(LibreEffects::Core::BlendSpace space)
+    {
+        if (m_blendSpace == space) return;
+        m_blendSpace = space;
+        // Group caches notice the change when they are next brought up to date
+        invalidateCaches();
+    }
+
+    void Compositor::invalidateCaches()
+    {
+        m_belowValid = QRegion();
+        m_aboveValid = QRegion();
+    }
+
+    void Compositor::releaseCaches()
+    {
+        m_belowCache = QImage();
+        m_aboveCache = QImage();
+        m_cachedStack.clear();
+        m_cachedActive = -1;
+        invalidateCaches();
+    }
+
+    bool Compositor::canFlattenAbove(const std::vector<std::shared_ptr<Layer>>& layers, int activeIndex,
+                                     const std::vector<std::shared_ptr<LayerGroup>>& groups)
+    {
+        for (int i = activeIndex + 1; i < static_cast<int>(layers.size()); ++i) {
+            const Layer& layer = *layers[i];
+            if (!layer.isVisible()) continue;
+            if (layer.getBlendMode() != BlendMode::Normal) {
+                return false;
+            }
+        }
+        for (const auto& group : groups) {
+            if (!isNormalOnly(*group)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Compositor::isNormalOnly(const LayerGroup& group)
+    {
+        if (!group.isVisible()) return true;
+        if (group.isIsolated()) return group.getBlendMode() == BlendMode::Normal;
+
+        for (const auto& layer : group.getLayers()) {
+            if (layer->isVisible() && layer->getBlendMode() != BlendMode::Normal) {
+                return false;
+            }
+        }
+        for (const auto& child : group.getGroups()) {
+            if (!isNormalOnly(*child)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Compositor::copyPixels(QImage& view, const QImage& source)
+    {
+        const size_t rowBytes = static_cast<size_t>(view.width()) * (view.depth() / 8);
+        for (int y = 0; y < view.height(); ++y) {
+            std::memcpy(view.scanLine(y), source.constScanLine(y), rowBytes);
+        }
+    }
+
+    void Compositor::ensureGroupCache(GroupCache& cache, const QRect& bounds, QImage::Format format,
+                                      LibreEffects::Core::BlendSpace space)
+    {
+        // Whole tiles, so content growing a little does not reallocate
+        const QRect needed(QPoint(bounds.left() / TileSize * TileSize, bounds.top() / TileSize * TileSize),
+                           QPoint((bounds.right() / TileSize + 1) * TileSize - 1,
+                                  (bounds.bottom() / TileSize + 1) * TileSize - 1));
+        if (cache.image.isNull() || cache.image.format() != format || cache.space != space) {
+            cache.image = QImage(needed.size(), format);
+            cache.rect = needed;
+            cache.valid = QRegion();
+            cache.space = space;
+            return;
+        }
+        if (cache.rect.contains(needed)) return;
+
+        // Grow, keeping what is already composited
+        const QRect grown = needed.united(cache.rect);
+        QImage image(grown.size(), format);
+        const QPoint shift = cache.rect.topLeft() - grown.topLeft();
+        QImage view = Buffer(image).view(QRect(shift, cache.rect.size()));
+        copyPixels(view, cache.image);
+        cache.image = image;
+        cache.rect = grown;
+    }
+
+    void Compositor::updateGroupCaches(const std::vector<std::shared_ptr<LayerGroup>>& groups, const QRegion& region,
+                                       const QRect& targetRect, QImage::Format format) const
+    {
+        GroupLevels levels;
+        collectGroupPieces(groups, region, targetRect, format, levels, 0);
+
+        // Children before their parents; everything on one level is
+        // independent, siblings and tiles alike
+        auto compositePiece = [&](const GroupPiece& piece) {
+            QImage view = piece.cache.view(piece.rect.translated(-piece.group->getCache().rect.topLeft()));
+            view.fill(Qt::transparent);
+            blendLayers(view, piece.rect, piece.group->getLayers(), 0,
+                        static_cast<int>(piece.group->getLayers().size()));
+            blendGroups(view, piece.rect, piece.group->getGroups());
+        };
+
+        for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+            if (m_multithreaded && level->size() > 1) {
+                QtConcurrent::blockingMap(*level, compositePiece);
+            } else {
+                for (const GroupPiece& piece : *level) {
+                    compositePiece(piece);
+                }
+            }
+            for (const GroupPiece& piece : *level) {
+                piece.group->getCache().valid += piece.rect;
+            }
+        }
+    }
+
+    void Compositor::collectGroupPieces(const std::vector<std::shared_ptr<LayerGroup>>& groups, const QRegion& region,
+                                        const QRect& targetRect, QImage::Format format,
+                                        GroupLevels& levels, size_t depth) const
+    {
+        for (const auto& group : groups) {
+            if (!group->isVisible() || group->getOpacity() <= 0.0f) continue;
+            const QRect bounds = group->getContentBounds().intersected(targetRect);
+            const QRegion groupRegion = region.intersected(bounds);
+            if (groupRegion.isEmpty()) continue;
+
+            if (!group->isIsolated()) {
+                // Children are blended in place wherever the group shows
+                collectGroupPieces(group->getGroups(), groupRegion, targetRect, format, levels, depth);
+                continue;
+            }
+
+            GroupCache& cache = group->getCache();
+            ensureGroupCache(cache, bounds, format, m_blendSpace);
+            const QRegion stale = groupRegion.subtracted(cache.valid);
+            if (stale.isEmpty()) continue;
+
+            if (levels.size() <= depth) {
+                levels.resize(depth + 1);
+            }
+            const Buffer buffer(cache.image);
+            for (const QRect& rect : splitIntoTiles(stale)) {
+                levels[depth].push_back({ group.get(), rect, buffer });
+            }
+            collectGroupPieces(group->getGroups(), stale, targetRect, format, levels, depth + 1);
+        }
+    }
+
+    std::vector<QRect> Compositor::splitIntoTiles(const QRegion& region)
+    {
+        std::vector<QRect> pieces;
+        for (const QRect& rect : region) {
+            int firstColumn = rect.left() / TileSize;
+            int lastColumn = rect.right() / TileSize;
+            int firstRow = rect.top() / TileSize;
+            int lastRow = rect.bottom() / TileSize;
+            for (int row = firstRow; row <= lastRow; ++row) {
+                for (int column = firstColumn; column <= lastColumn; ++column) {
+                    QRect cell(column * TileSize, row * TileSize, TileSize, TileSize);
+                    pieces.push_back(rect.intersected(cell));
+                }
+            }
+        }
+        return pieces;
+    }
+
+    void Compositor::compositeTile(QImage& view, const QRect& area, const QColor& background,
+                                   const std::vector<std::shared_ptr<Layer>>& layers,
+                                   const std::vector<std::shared_ptr<LayerGroup>>& groups) const
+    {
+        view.fill(background);
+        blendLayers(view, area, layers, 0, static_cast<int>(layers.size()));
+        blendGroups(view, area, groups);
+    }
+
+    void Compositor::blendLayers(QImage& view, const QRect& area,
+                                 const std::vector<std::shared_ptr<Layer>>& layers, int first, int last) const
+    {
+        // Nothing under an opaque Normal layer shows through; start there
+        for (int i = last - 1; i > first; --i) {
+            if (layers[i]->occludes(area)) {
+                first = i;
+                break;
+            }
+        }
+
+        // Render layers from bottom to top
+        for (int i = first; i < last; ++i) {
+            const Layer& layer = *layers[i];
+            if (!layer.isVisible() || layer.getOpacity() <= 0.0f) continue;
+            if (!layer.getContentBounds().intersects(area)) continue;
+            blendLayer(view, area, layer);
+        }
+    }
+
+    void Compositor::blendLayer(QImage& view, const QRect& area, const Layer& layer) const
+    {
+        const TiledSurface& surface = layer.getSurface();
+        const QPoint offset = layer.getOffset();
+        // Transparent source pixels leave the backdrop unchanged in every
+        // blend mode, so only the content box needs blending
+        const QRect layerArea = area.translated(-offset).intersected(surface.getContentBounds());
+
+        int firstColumn, firstRow, lastColumn, lastRow;
+        if (!surface.tileRange(layerArea, firstColumn, firstRow, lastColumn, lastRow)) return;
+
+        // Layers share the target's premultiplied format; the document
+        // converts any that arrive in another one
+        Q_ASSERT(surface.getFormat() == view.format());
+        const auto format = corePixelFormat(view.format());
+        const auto blendRow = LibreEffects::Core::blendRowFunction(format, toCoreBlendMode(layer.getBlendMode()),
+                                                                   m_blendSpace);
+        const auto blendMaskedRow = LibreEffects::Core::maskedBlendRowFunction(format, toCoreBlendMode(layer.getBlendMode()),
+                                                                               m_blendSpace);
+        const int bytesPerPixel = view.depth() / 8;
+        const float opacity = layer.getOpacity();
+        const QImage& mask = layer.getMask();
+
+        for (int row = firstRow; row <= lastRow; ++row) {
+            for (int column = firstColumn; column <= lastColumn; ++column) {
+                const QRect overlap = surface.tileContentBounds(column, row).intersected(layerArea);
+                if (overlap.isEmpty()) continue;
+
+                const QImage& source = surface.tile(column, row);
+                const QRect tileBounds = surface.tileRect(column, row);
+                const int width = overlap.width();
+
+                for (int y = overlap.top(); y <= overlap.bottom(); ++y) {
+                    const uchar* src = source.constScanLine(y - tileBounds.y())
+                                       + (overlap.x() - tileBounds.x()) * bytesPerPixel;
+                    uchar* dst = view.scanLine(y + offset.y() - area.y())
+                                 + (overlap.x() + offset.x() - area.x()) * bytesPerPixel;
+                    if (mask.isNull()) {
+                        blendRow(dst, src, width, opacity);
+                    } else {
+                        blendMaskedRow(dst, src, mask.constScanLine(y) + overlap.x(), width, opacity);
+                    }
+                }
+            }
+        }
+    }
+
+    void Compositor::blendGroups(QImage& view, const QRect& area,
+                                 const std::vector<std::shared_ptr<LayerGroup>>& groups) const
+    {
+        for (const auto& group : groups) {
+            blendGroup(view, area, *group);
+        }
+    }
+
+    void Compositor::blendGroup(QImage& view, const QRect& area, const LayerGroup& group) const
+    {
+        if (!group.isVisible() || group.getOpacity() <= 0.0f) return;
+
+        if (!group.isIsolated()) {
+            blendLayers(view, area, group.getLayers(), 0, static_cast<int>(group.getLayers().size()));
+            blendGroups(view, area, group.getGroups());
+            return;
+        }
+
+        // The cache was brought up to date for this area before compositing
+        const GroupCache& cache = group.getCache();
+        const QRect overlap = area.intersected(cache.rect).intersected(group.getContentBounds());
+        if (overlap.isEmpty()) return;
+
+        const auto blendRow = LibreEffects::Core::blendRowFunction(corePixelFormat(view.format()),
+                                                                   toCoreBlendMode(group.getBlendMode()), m_blendSpace);
+        const int bytesPerPixel = view.depth() / 8;
+        for (int y = overlap.top(); y <= overlap.bottom(); ++y) {
+            const uchar* src = cache.image.constScanLine(y - cache.rect.y())
+                               + (overlap.x() - cache.rect.x()) * bytesPerPixel;
+            uchar* dst = view.scanLine(y - area.y()) + (overlap.x() - area.x()) * bytesPerPixel;
+            blendRow(dst, src, overlap.width(), group.getOpacity());
+        }
+    }
+
+    void Compositor::blendImage(QImage& view, const QImage& source) const
+    {
+        const auto blendRow = LibreEffects::Core::blendRowFunction(corePixelFormat(view.format()),
+                                                                   LibreEffects::Core::BlendMode::Normal, m_blendSpace);
+        for (int y = 0; y < view.height(); ++y) {
+            blendRow(view.scanLine(y), source.constScanLine(y), view.width(), 1.0f);
+        }
+    }
+
+} // namespace LibreCanvas
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <QImage>
+#include <QRegion>
+#include <QColor>
+#include <memory>
+#include <vector>
+#include "layer.h"
+
+namespace LibreCanvas {
+
+    // Blends a layer stack into a premultiplied target image (8-bit, 16-bit
+    // or float, matching the layers) using the core SIMD blend kernels. The
+    // requested region is cut along the tile grid and independent tiles are
+    // composited in parallel; every pixel goes through the same operations
+    // as on a single thread, so the output does not depend on the thread
+    // count.
+    class Compositor {
+    public:
+        static constexpr int TileSize = TiledSurface::TileSize;
+
+        Compositor();
+
+        bool isMultithreaded() const { return m_multithreaded; }
+        void setMultithreaded(bool enabled) { m_multithreaded = enabled; }
+
+        // Whether layers blend on encoded sRGB values or in linear light.
+        // Changing it invalidates every cache.
+        LibreEffects::Core::BlendSpace getBlendSpace() const { return m_blendSpace; }
+        void setBlendSpace(LibreEffects::Core::BlendSpace space);
+
+        // Groups stack above the layers. Isolated groups are composited into
+        // their own caches first, deepest level first, with sibling groups
+        // and tiles running in parallel.
+        void composite(QImage& target, const QRegion& region, const QColor& background,
+                       const std::vector<std::shared_ptr<Layer>>& layers,
+                       const std::vector<std::shared_ptr<LayerGroup>>& groups = {}) const;
+
+        // Like composite(), but keeps the background and layers below the
+        // active one flattened in a cache, and the layers above it too when
+        // they all use Normal blending. While only the active layer changes,
+        // each pixel then costs a copy and at most two blends.
+        void compositeAround(QImage& target, const QRegion& region, const QColor& background,
+                             const std::vector<std::shared_ptr<Layer>>& layers, int activeIndex,
+                             const std::vector<std::shared_ptr<LayerGroup>>& groups = {});
+
+        // Invalidate cached pixels after layers below or above the active
+        // one changed. Stack, background and size changes are picked up by
+        // compositeAround() itself.
+        void invalidateBelow(const QRegion& region) { m_belowValid -= region; }
+        void invalidateAbove(const QRegion& region) { m_aboveValid -= region; }
+        void invalidateCaches();
+        void releaseCaches();
+
+    private:
+        // Raw access to an image that pieces are composited into from several
+        // threads; taken once so workers never touch the shared QImage
+        struct Buffer {
+            explicit Buffer(QImage& image);
+            QImage view(const QRect& rect) const;
+
+            uchar* bits;
+            qsizetype bytesPerLine;
+            QImage::Format format;
+            int bytesPerPixel;
+        };
+
+        // One tile of an isolated group's cache to recomposite
+        struct GroupPiece {
+            const LayerGroup* group;
+            QRect rect;
+            Buffer cache;
+        };
+        using GroupLevels = std::vector<std::vector<GroupPiece>>;
+
+        static std::vector<QRect> splitIntoTiles(const QRegion& region);
+        static bool canFlattenAbove(const std::vector<std::shared_ptr<Layer>>& layers, int activeIndex,
+                                    const std::vector<std::shared_ptr<LayerGroup>>& groups);
+        static bool isNormalOnly(const LayerGroup& group);
+        static void copyPixels(QImage& view, const QImage& source);
+        static void ensureGroupCache(GroupCache& cache, const QRect& bounds, QImage::Format format,
+                                     LibreEffects::Core::BlendSpace space);
+
+        void updateGroupCaches(const std::vector<std::shared_ptr<LayerGroup>>& groups, const QRegion& region,
+                               const QRect& targetRect, QImage::Format format) const;
+        void collectGroupPieces(const std::vector<std::shared_ptr<LayerGroup>>& groups, const QRegion& region,
+                                const QRect& targetRect, QImage::Format format,
+                                GroupLevels& levels, size_t depth) const;
+
+        void compositeTile(QImage& view, const QRect& area, const QColor& background,
+                           const std::vector<std::shared_ptr<Layer>>& layers,
+                           const std::vector<std::shared_ptr<LayerGroup>>& groups) const;
+        void blendLayers(QImage& view, const QRect& area,
+                         const std::vector<std::shared_ptr<Layer>>& layers, int first, int last) const;
+        void blendLayer(QImage& view, const QRect& area, const Layer& layer) const;
+        void blendGroups(QImage& view, const QRect& area,
+                         const std::vector<std::shared_ptr<LayerGroup>>& groups) const;
+        void blendGroup(QImage& view, const QRect& area, const LayerGroup& group) const;
+        void blendImage(QImage& view, const QImage& source) const;
+
+        bool m_multithreaded;
+        LibreEffects::Core::BlendSpace m_blendSpace;
+
+        // Caches around the active layer, in target coordinates
+        QImage m_belowCache;
+        QImage m_aboveCache;
+        QRegion m_belowValid;
+        QRegion m_aboveValid;
+        std::vector<const Layer*> m_cachedStack;
+        int m_cachedActive;
+        QColor m_cachedBackground;
+        bool m_aboveFlattened;
+    };
+
+} // namespace LibreCanvas
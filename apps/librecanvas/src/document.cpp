@@ -1,55 +1,115 @@
 #include "document.h"
 #include "history.h"
-#include <QPainter>
+#include "core/downsample.h"
 #include <algorithm>
+#include <cmath>
+#include <functional>
 
 namespace LibreCanvas {
 
-    Document::Document(int width, int height, const QColor& backgroundColor)
+    Document::Document(int width, int height, const QColor& backgroundColor, PixelDepth depth)
         : m_size(width, height)
         , m_backgroundColor(backgroundColor)
+        , m_depth(depth)
         , m_historyManager(nullptr)
+        , m_editing(false)
     {
         // Create initial background layer
-        auto bgLayer = std::make_shared<Layer>("Background", width, height);
-        bgLayer->getImage().fill(backgroundColor);
+        auto bgLayer = std::make_shared<Layer>("Background", width, height, getImageFormat());
+        bgLayer->getSurface().fill(backgroundColor);
         bgLayer->setLocked(true);
         m_layers.push_back(bgLayer);
         m_activeLayer = bgLayer;
+        m_snapshotDirty = QRect(QPoint(0, 0), m_size);
+    }
+
+    Document::Document(const Document& other, CloneTag)
+        : m_size(other.m_size)
+        , m_backgroundColor(other.m_backgroundColor)
+        , m_depth(other.m_depth)
+        , m_historyManager(nullptr)
+        , m_editing(false)
+    {
+        // No background layer here; the stack is taken over from other
+        m_compositor.setBlendSpace(other.getBlendSpace());
+        restore(other);
     }
 
     Document::~Document() = default;
 
+    std::shared_ptr<Document> Document::clone() const
+    {
+        return std::shared_ptr<Document>(new Document(*this, CloneTag()));
+    }
+
+    void Document::restore(const Document& state)
+    {
+        // Restored layers are copies too, so editing them never reaches
+        // back into the history state
+        const int activeIndex = state.getActiveLayerIndex();
+        m_size = state.m_size;
+        // Layers keep the pixel format of the state; the projection is
+        // reallocated to match on the next update
+        m_depth = state.m_depth;
+        m_backgroundColor = state.m_backgroundColor;
+        m_layers.clear();
+        for (const auto& layer : state.m_layers) {
+            m_layers.push_back(layer->clone());
+        }
+        m_groups.clear();
+        for (const auto& group : state.m_groups) {
+            m_groups.push_back(group->clone());
+        }
+        m_activeLayer = activeIndex >= 0 ? m_layers[activeIndex] : nullptr;
+        markAllDirty();
+    }
+
     void Document::setSize(const QSize& size)
     {
         m_size = size;
         // Resize all layers
         for (auto& layer : m_layers) {
             QImage resized = layer->getImage().scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-            layer->getImage() = resized;
+            layer->setImage(resized);
         }
+        m_projection = QImage();
+        m_mipLevels.clear();
+        markAllDirty();
+    }
+
+    void Document::setBlendSpace(LibreEffects::Core::BlendSpace space)
+    {
+        if (space == getBlendSpace()) return;
+        m_compositor.setBlendSpace(space);
+        markAllDirty();
     }
 
     void Document::addLayer(std::shared_ptr<Layer> layer)
     {
+        // Every layer is kept in the document's pixel format
+        layer->convertToFormat(getImageFormat());
         m_layers.push_back(layer);
         m_activeLayer = layer;
+        markDirty(layer->getContentBounds());
     }
 
     void Document::insertLayer(std::shared_ptr<Layer> layer, int index)
     {
+        layer->convertToFormat(getImageFormat());
         if (index < 0 || index > static_cast<int>(m_layers.size())) {
             m_layers.push_back(layer);
         } else {
             m_layers.insert(m_layers.begin() + index, layer);
         }
         m_activeLayer = layer;
+        markDirty(layer->getContentBounds());
     }
 
     void Document::removeLayer(std::shared_ptr<Layer> layer)
     {
         auto it = std::find(m_layers.begin(), m_layers.end(), layer);
         if (it != m_layers.end()) {
+            markDirty(layer->getContentBounds());
             m_layers.erase(it);
             // Set new active layer
             if (m_layers.empty()) {
@@ -70,6 +130,7 @@ namespace LibreCanvas {
         auto layer = m_layers[fromIndex];
         m_layers.erase(m_layers.begin() + fromIndex);
         m_layers.insert(m_layers.begin() + toIndex, layer);
+        markDirty(layer->getContentBounds());
     }
 
     std::shared_ptr<Layer> Document::getLayer(int index) const
@@ -80,6 +141,23 @@ namespace LibreCanvas {
         return m_layers[index];
     }
 
+    static std::shared_ptr<Layer> findLayerIn(const std::vector<std::shared_ptr<Layer>>& layers,
+                                              const std::vector<std::shared_ptr<LayerGroup>>& groups, quint64 id)
+    {
+        for (const auto& layer : layers) {
+            if (layer->getId() == id) return layer;
+        }
+        for (const auto& group : groups) {
+            if (auto layer = findLayerIn(group->getLayers(), group->getGroups(), id)) return layer;
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<Layer> Document::findLayer(quint64 id) const
+    {
+        return findLayerIn(m_layers, m_groups, id);
+    }
+
     void Document::setActiveLayer(std::shared_ptr<Layer> layer)
     {
         if (std::find(m_layers.begin(), m_layers.end(), layer) != m_layers.end()) {
@@ -95,17 +173,63 @@ namespace LibreCanvas {
         }
     }
 
+    int Document::getActiveLayerIndex() const
+    {
+        auto it = std::find(m_layers.begin(), m_layers.end(), m_activeLayer);
+        return it != m_layers.end() ? static_cast<int>(it - m_layers.begin()) : -1;
+    }
+
     void Document::addGroup(std::shared_ptr<LayerGroup> group)
     {
         m_groups.push_back(group);
+        markDirty(group->getContentBounds());
     }
 
     void Document::removeGroup(std::shared_ptr<LayerGroup> group)
     {
-        m_groups.erase(
-            std::remove(m_groups.begin(), m_groups.end(), group),
-            m_groups.end()
-        );
+        auto it = std::find(m_groups.begin(), m_groups.end(), group);
+        if (it != m_groups.end()) {
+            markDirty(group->getContentBounds());
+            m_groups.erase(it);
+        }
+    }
+
+    RenderSnapshot Document::takeSnapshot()
+    {
+        RenderSnapshot snapshot;
+        snapshot.size = m_size;
+        snapshot.background = m_backgroundColor;
+        snapshot.depth = m_depth;
+        snapshot.blendSpace = getBlendSpace();
+        snapshot.activeIndex = getActiveLayerIndex();
+        snapshot.dirty = m_snapshotDirty;
+        m_snapshotDirty = QRegion();
+
+        QRegion taken;
+        for (const auto& layer : m_layers) {
+            snapshot.layers.push_back(layer->takeSnapshot());
+            taken += snapshot.layers.back()->getDirtyRegion();
+        }
+        for (const auto& group : m_groups) {
+            snapshot.groups.push_back(group->takeSnapshot());
+            taken += snapshot.groups.back()->getPendingRegion();
+        }
+
+        // Keep the local projection correct; its caches cannot tell which
+        // side of the active layer these came from
+        m_dirtyRegion += taken;
+        if (m_dirtyRegion.rectCount() > 32) {
+            m_dirtyRegion = m_dirtyRegion.boundingRect();
+        }
+        return snapshot;
+    }
+
+    void Document::setStack(const std::vector<std::shared_ptr<Layer>>& layers,
+                            const std::vector<std::shared_ptr<LayerGroup>>& groups, int activeIndex)
+    {
+        m_layers = layers;
+        m_groups = groups;
+        m_activeLayer = activeIndex >= 0 && activeIndex < static_cast<int>(layers.size()) ? layers[activeIndex] : nullptr;
     }
 
     QImage Document::render() const
@@ -115,25 +239,174 @@ namespace LibreCanvas {
 
     QImage Document::renderToImage(const QSize& size) const
     {
-        QImage result(size, QImage::Format_ARGB32);
-        result.fill(m_backgroundColor);
+        if (size == m_size) {
+            updateProjection();
+            return m_projection;
+        }
 
-        QPainter painter(&result);
-        painter.setRenderHint(QPainter::Antialiasing);
+        QImage result(size, getImageFormat());
+        m_compositor.composite(result, result.rect(), m_backgroundColor, m_layers, m_groups);
+        return result;
+    }
 
-        // Render all layers from bottom to top
-        for (const auto& layer : m_layers) {
-            layer->render(painter, QRect(QPoint(0, 0), size));
+    QRegion Document::updateProjection(const QRect& area) const
+    {
+        // Document-level changes may affect any layer; layer changes only
+        // spoil the cache on their side of the active layer
+        m_compositor.invalidateBelow(m_dirtyRegion);
+        m_compositor.invalidateAbove(m_dirtyRegion);
+
+        const int activeIndex = getActiveLayerIndex();
+        for (int i = 0; i < static_cast<int>(m_layers.size()); ++i) {
+            QRegion layerDirty = m_layers[i]->takeDirtyRegion();
+            if (layerDirty.isEmpty()) continue;
+            if (i < activeIndex) {
+                m_compositor.invalidateBelow(layerDirty);
+            } else if (i > activeIndex) {
+                m_compositor.invalidateAbove(layerDirty);
+            }
+            m_dirtyRegion += layerDirty;
         }
 
-        painter.end();
-        return result;
+        // Groups stack above every layer
+        for (const auto& group : m_groups) {
+            QRegion groupDirty = group->takeDirtyRegion();
+            if (groupDirty.isEmpty()) continue;
+            m_compositor.invalidateAbove(groupDirty);
+            m_dirtyRegion += groupDirty;
+        }
+
+        if (m_projection.size() != m_size || m_projection.format() != getImageFormat()) {
+            m_projection = QImage(m_size, getImageFormat());
+            // Areas outside the requested one stay pending; mip levels and
+            // filtering still read them, so they must hold defined pixels
+            m_projection.fill(Qt::transparent);
+            m_dirtyRegion = QRect(QPoint(0, 0), m_size);
+            m_mipLevels.clear();
+        }
+
+        m_dirtyRegion = m_dirtyRegion.intersected(m_projection.rect());
+        QRegion updated = m_dirtyRegion.intersected(area);
+        m_dirtyRegion -= updated;
+
+        // A stroke leaves many small rectangles behind; past a point one
+        // bounding box is cheaper than compositing each of them
+        if (updated.rectCount() > 32) {
+            updated = updated.boundingRect();
+        }
+
+        m_compositor.compositeAround(m_projection, updated, m_backgroundColor, m_layers, activeIndex, m_groups);
+        updateMipLevels(updated);
+        return updated;
+    }
+
+    const QImage& Document::getMipLevel(int level) const
+    {
+        if (level <= 0) return m_projection;
+
+        // Build missing levels from the one above them
+        while (static_cast<int>(m_mipLevels.size()) < level) {
+            const QImage& source = m_mipLevels.empty() ? m_projection : m_mipLevels.back();
+            if (source.width() <= 1 && source.height() <= 1) break;
+
+            QImage next((source.width() + 1) / 2, (source.height() + 1) / 2, source.format());
+            downsampleInto(next, source, next.rect());
+            m_mipLevels.push_back(next);
+        }
+        return m_mipLevels.empty() ? m_projection : m_mipLevels[std::min<size_t>(level, m_mipLevels.size()) - 1];
+    }
+
+    int Document::mipLevelForZoom(float zoom)
+    {
+        // The deepest level that is still at least as large as the display,
+        // so the final scale only ever shrinks by less than half
+        if (zoom >= 1.0f || zoom <= 0.0f) return 0;
+        return static_cast<int>(std::floor(std::log2(1.0f / zoom)));
+    }
+
+    void Document::updateMipLevels(const QRegion& region) const
+    {
+        QRegion levelRegion = region;
+        for (size_t i = 0; i < m_mipLevels.size() && !levelRegion.isEmpty(); ++i) {
+            const QImage& source = i == 0 ? m_projection : m_mipLevels[i - 1];
+            QImage& level = m_mipLevels[i];
+
+            // Every touched source pixel spoils the pixel it averages into
+            QRegion halved;
+            for (const QRect& rect : levelRegion) {
+                halved += QRect(QPoint(rect.left() / 2, rect.top() / 2), QPoint(rect.right() / 2, rect.bottom() / 2));
+            }
+            levelRegion = halved.intersected(level.rect());
+            for (const QRect& rect : levelRegion) {
+                downsampleInto(level, source, rect);
+            }
+        }
+    }
+
+    void Document::downsampleInto(QImage& level, const QImage& source, const QRect& levelRect)
+    {
+        const int bytesPerPixel = level.depth() / 8;
+        LibreEffects::Core::downsample2x(corePixelFormat(level.format()),
+                                         level.scanLine(levelRect.y()) + levelRect.x() * bytesPerPixel,
+                                         level.bytesPerLine() / bytesPerPixel,
+                                         source.constBits(), source.bytesPerLine() / bytesPerPixel,
+                                         source.width(), source.height(),
+                                         levelRect.x(), levelRect.y(), levelRect.width(), levelRect.height());
     }
 
     void Document::saveState(const QString& description)
     {
-        // History manager will be called from canvas widget with the shared_ptr
-        // This method is kept for compatibility but actual saving happens in canvas widget
+        if (m_historyManager) {
+            m_historyManager->pushState(*this, description);
+        }
+    }
+
+    void Document::recordCommand(std::shared_ptr<HistoryCommand> command, const QString& description)
+    {
+        if (m_historyManager) {
+            m_historyManager->pushCommand(*this, std::move(command), description);
+        }
+    }
+
+    static void forEachLayer(const std::vector<std::shared_ptr<Layer>>& layers,
+                             const std::vector<std::shared_ptr<LayerGroup>>& groups,
+                             const std::function<void(Layer&)>& visit)
+    {
+        for (const auto& layer : layers) {
+            visit(*layer);
+        }
+        for (const auto& group : groups) {
+            forEachLayer(group->getLayers(), group->getGroups(), visit);
+        }
+    }
+
+    void Document::beginEdit()
+    {
+        if (!m_historyManager || m_editing) return;
+        m_editing = true;
+        forEachLayer(m_layers, m_groups, [](Layer& layer) { layer.beginCapture(); });
+    }
+
+    void Document::endEdit(const QString& description)
+    {
+        if (!m_editing) return;
+        m_editing = false;
+
+        std::vector<TileEditCommand::LayerTiles> edited;
+        forEachLayer(m_layers, m_groups, [&](Layer& layer) {
+            std::vector<TiledSurface::TileState> before = layer.endCapture();
+            if (before.empty()) return;
+
+            std::vector<TiledSurface::TileState> after;
+            after.reserve(before.size());
+            for (const TiledSurface::TileState& state : before) {
+                after.push_back(layer.getSurface().saveTile(state.column, state.row));
+            }
+            edited.push_back({ layer.getId(), std::move(before), std::move(after) });
+        });
+        if (!edited.empty()) {
+            recordCommand(std::make_shared<TileEditCommand>(std::move(edited)), description);
+        }
     }
 
     bool Document::canUndo() const
@@ -148,27 +421,16 @@ namespace LibreCanvas {
 
     void Document::undo()
     {
-        if (!m_historyManager) return;
-        
-        auto doc = m_historyManager->undo();
-        if (doc) {
-            // Copy state from history
-            m_layers = doc->m_layers;
-            m_activeLayer = doc->m_activeLayer;
-            m_groups = doc->m_groups;
+        // Snapshots restore the whole stack; commands only touch their layer
+        if (m_historyManager) {
+            m_historyManager->undo(*this);
         }
     }
 
     void Document::redo()
     {
-        if (!m_historyManager) return;
-        
-        auto doc = m_historyManager->redo();
-        if (doc) {
-            // Copy state from history
-            m_layers = doc->m_layers;
-            m_activeLayer = doc->m_activeLayer;
-            m_groups = doc->m_groups;
+        if (m_historyManager) {
+            m_historyManager->redo(*this);
         }
     }
 
@@ -1,23 +1,49 @@
 #pragma once
 
 #include "layer.h"
+#include "compositor.h"
+#include "pixeldepth.h"
 #include <QSize>
 #include <QColor>
+#include <QImage>
+#include <QRegion>
 #include <vector>
 #include <memory>
 
 namespace LibreCanvas {
 
+    // A document's layer stack copied for rendering on another thread.
+    // Pixels stay shared with the document until either side writes them.
+    struct RenderSnapshot {
+        QSize size;
+        QColor background;
+        PixelDepth depth = PixelDepth::Uint8;
+        LibreEffects::Core::BlendSpace blendSpace = LibreEffects::Core::BlendSpace::Srgb;
+        std::vector<std::shared_ptr<Layer>> layers;
+        std::vector<std::shared_ptr<LayerGroup>> groups;
+        int activeIndex = -1;
+        // Document-level changes; layer changes travel with the layers
+        QRegion dirty;
+    };
+
     class Document {
     public:
-        Document(int width, int height, const QColor& backgroundColor = Qt::white);
+        Document(int width, int height, const QColor& backgroundColor = Qt::white,
+                 PixelDepth depth = PixelDepth::Uint8);
         ~Document();
 
         // Document properties
         QSize getSize() const { return m_size; }
         void setSize(const QSize& size);
         QColor getBackgroundColor() const { return m_backgroundColor; }
-        void setBackgroundColor(const QColor& color) { m_backgroundColor = color; }
+        void setBackgroundColor(const QColor& color) { m_backgroundColor = color; markAllDirty(); }
+        PixelDepth getPixelDepth() const { return m_depth; }
+        QImage::Format getImageFormat() const { return imageFormat(m_depth); }
+
+        // Linear-light blending for compositing and painting; pixels stay
+        // sRGB-encoded either way
+        LibreEffects::Core::BlendSpace getBlendSpace() const { return m_compositor.getBlendSpace(); }
+        void setBlendSpace(LibreEffects::Core::BlendSpace space);
 
         // Layer management
         void addLayer(std::shared_ptr<Layer> layer);
@@ -29,33 +55,98 @@ namespace LibreCanvas {
         std::shared_ptr<Layer> getActiveLayer() const { return m_activeLayer; }
         void setActiveLayer(std::shared_ptr<Layer> layer);
         void setActiveLayer(int index);
+        int getActiveLayerIndex() const;
 
         int getLayerCount() const { return static_cast<int>(m_layers.size()); }
         const std::vector<std::shared_ptr<Layer>>& getLayers() const { return m_layers; }
+        // Top-level or inside a group; null when no layer has the id
+        std::shared_ptr<Layer> findLayer(quint64 id) const;
 
-        // Layer groups
+        // Layer groups, rendered above the top-level layers
         void addGroup(std::shared_ptr<LayerGroup> group);
         void removeGroup(std::shared_ptr<LayerGroup> group);
+        const std::vector<std::shared_ptr<LayerGroup>>& getGroups() const { return m_groups; }
 
         // Rendering
         QImage render() const;
         QImage renderToImage(const QSize& size) const;
 
+        // Incremental rendering into the persistent projection buffer.
+        // updateProjection() recomposites only the areas reported dirty
+        // since the last call and returns them. Given an area, dirty pixels
+        // outside it are left pending for a later call.
+        QRegion updateProjection() const { return updateProjection(QRect(QPoint(0, 0), m_size)); }
+        QRegion updateProjection(const QRect& area) const;
+        const QImage& getProjection() const { return m_projection; }
+        // Projection pixels not composited yet, such as those outside the
+        // last area given to updateProjection()
+        const QRegion& getPendingRegion() const { return m_dirtyRegion; }
+        void markDirty(const QRect& rect) { m_dirtyRegion += rect; m_snapshotDirty += rect; }
+        void markDirty(const QRegion& region) { m_dirtyRegion += region; m_snapshotDirty += region; }
+        void markAllDirty() { markDirty(QRect(QPoint(0, 0), m_size)); }
+
+        // Mip pyramid of the projection for zoomed-out display. Level 0 is
+        // the projection itself and each further level halves both sides.
+        // Levels are built on first use and then follow updateProjection()
+        // by re-downsampling only what it recomposited.
+        const QImage& getMipLevel(int level) const;
+        static int mipLevelForZoom(float zoom);
+
+        Compositor& getCompositor() { return m_compositor; }
+
+        // Copies the stack for a render thread, moving everything marked
+        // dirty since the last snapshot onto it. The document's own
+        // projection still sees those changes.
+        RenderSnapshot takeSnapshot();
+        // Used by render replicas: replaces the stack without marking
+        // anything dirty, since the snapshot carries its own dirty regions
+        void setStack(const std::vector<std::shared_ptr<Layer>>& layers,
+                      const std::vector<std::shared_ptr<LayerGroup>>& groups, int activeIndex);
+
         // History/Undo
+        // Copy of the document state whose layers share tiles with this
+        // document until either side writes them
+        std::shared_ptr<Document> clone() const;
         void setHistoryManager(class HistoryManager* manager) { m_historyManager = manager; }
+        // Records the document as it is now, for edits that change pixels
         void saveState(const QString& description = "");
+        // Records an edit already made, as a command
+        void recordCommand(std::shared_ptr<class HistoryCommand> command, const QString& description = "");
+        // Pixel edits recorded per tile: from beginEdit() on, the first
+        // write to each tile of any layer saves it, and endEdit() records
+        // just the saved tiles and their new contents. Beginning costs
+        // nothing however large the document is.
+        void beginEdit();
+        void endEdit(const QString& description = "");
         bool canUndo() const;
         bool canRedo() const;
         void undo();
         void redo();
 
     private:
+        friend class HistoryManager;
+
         QSize m_size;
         QColor m_backgroundColor;
+        PixelDepth m_depth;
         std::vector<std::shared_ptr<Layer>> m_layers;
         std::vector<std::shared_ptr<LayerGroup>> m_groups;
         std::shared_ptr<Layer> m_activeLayer;
         class HistoryManager* m_historyManager;
+        bool m_editing;
+
+        mutable Compositor m_compositor;
+        mutable QImage m_projection;
+        mutable QRegion m_dirtyRegion;
+        QRegion m_snapshotDirty;
+        mutable std::vector<QImage> m_mipLevels;
+
+        struct CloneTag {};
+        Document(const Document& other, CloneTag);
+        void restore(const Document& state);
+
+        void updateMipLevels(const QRegion& region) const;
+        static void downsampleInto(QImage& level, const QImage& source, const QRect& levelRect);
     };
 
 } // namespace LibreCanvas
@@ -1,87 +1,349 @@
 #include "history.h"
 #include <algorithm>
+#include <cstdlib>
+#include <unordered_set>
 
 namespace LibreCanvas {
 
+    namespace {
+
+        using ImageVisitor = std::function<void(QImage&)>;
+
+        // Every pixel slot of a stored document in a fixed order, empty
+        // tiles included, so a paged-out state can be filled back in
+        void forEachImage(Layer& layer, const ImageVisitor& visit)
+        {
+            TiledSurface& surface = layer.getSurface();
+            for (int row = 0; row < surface.getRows(); ++row) {
+                for (int column = 0; column < surface.getColumns(); ++column) {
+                    visit(surface.tileStorage(column, row));
+                }
+            }
+            visit(layer.getMask());
+        }
+
+        void forEachImage(LayerGroup& group, const ImageVisitor& visit)
+        {
+            for (const auto& layer : group.getLayers()) {
+                forEachImage(*layer, visit);
+            }
+            for (const auto& child : group.getGroups()) {
+                forEachImage(*child, visit);
+            }
+        }
+
+        void forEachImage(Document& document, const ImageVisitor& visit)
+        {
+            for (const auto& layer : document.getLayers()) {
+                forEachImage(*layer, visit);
+            }
+            for (const auto& group : document.getGroups()) {
+                forEachImage(*group, visit);
+            }
+        }
+
+        // Snapshot tiles and masks, or whatever pixels a command holds
+        void forEachImage(HistoryState& state, const ImageVisitor& visit)
+        {
+            if (state.getDocument()) {
+                forEachImage(*state.getDocument(), visit);
+            } else {
+                state.getCommand()->forEachImage(visit);
+            }
+        }
+
+        enum LayerField {
+            NameField = 1 << 0,
+            VisibleField = 1 << 1,
+            OpacityField = 1 << 2,
+            BlendModeField = 1 << 3,
+            OffsetField = 1 << 4
+        };
+
+    } // namespace
+
+    LayerProperties LayerProperties::of(const Layer& layer)
+    {
+        LayerProperties properties;
+        properties.name = layer.getName();
+        properties.visible = layer.isVisible();
+        properties.opacity = layer.getOpacity();
+        properties.blendMode = layer.getBlendMode();
+        properties.offset = layer.getOffset();
+        return properties;
+    }
+
+    void LayerProperties::applyTo(Layer& layer) const
+    {
+        // The setters skip unchanged values, so only what differs is dirtied
+        layer.setName(name);
+        layer.setVisible(visible);
+        layer.setOpacity(opacity);
+        layer.setBlendMode(blendMode);
+        layer.setOffset(offset);
+    }
+
+    bool LayerProperties::operator==(const LayerProperties& other) const
+    {
+        return name == other.name && visible == other.visible && opacity == other.opacity &&
+               blendMode == other.blendMode && offset == other.offset;
+    }
+
+    LayerPropertyCommand::LayerPropertyCommand(quint64 layerId, const LayerProperties& before,
+                                               const LayerProperties& after)
+        : m_layerId(layerId)
+        , m_before(before)
+        , m_after(after)
+    {
+    }
+
+    void LayerPropertyCommand::undo(Document& document)
+    {
+        if (auto layer = document.findLayer(m_layerId)) {
+            m_before.applyTo(*layer);
+        }
+    }
+
+    void LayerPropertyCommand::redo(Document& document)
+    {
+        if (auto layer = document.findLayer(m_layerId)) {
+            m_after.applyTo(*layer);
+        }
+    }
+
+    bool LayerPropertyCommand::mergeWith(const HistoryCommand& next)
+    {
+        auto other = dynamic_cast<const LayerPropertyCommand*>(&next);
+        if (!other || other->m_layerId != m_layerId || other->m_before != m_after ||
+            other->changedFields() != changedFields()) {
+            return false;
+        }
+        m_after = other->m_after;
+        return true;
+    }
+
+    int LayerPropertyCommand::changedFields() const
+    {
+        int fields = 0;
+        if (m_before.name != m_after.name) fields |= NameField;
+        if (m_before.visible != m_after.visible) fields |= VisibleField;
+        if (m_before.opacity != m_after.opacity) fields |= OpacityField;
+        if (m_before.blendMode != m_after.blendMode) fields |= BlendModeField;
+        if (m_before.offset != m_after.offset) fields |= OffsetField;
+        return fields;
+    }
+
+    TileEditCommand::TileEditCommand(std::vector<LayerTiles> layers)
+        : m_layers(std::move(layers))
+    {
+    }
+
+    void TileEditCommand::undo(Document& document)
+    {
+        for (const LayerTiles& tiles : m_layers) {
+            if (auto layer = document.findLayer(tiles.layerId)) {
+                layer->restoreTiles(tiles.before);
+            }
+        }
+    }
+
+    void TileEditCommand::redo(Document& document)
+    {
+        for (const LayerTiles& tiles : m_layers) {
+            if (auto layer = document.findLayer(tiles.layerId)) {
+                layer->restoreTiles(tiles.after);
+            }
+        }
+    }
+
+    void TileEditCommand::forEachImage(const std::function<void(QImage&)>& visit)
+    {
+        for (LayerTiles& tiles : m_layers) {
+            for (TiledSurface::TileState& state : tiles.before) {
+                visit(state.image);
+            }
+            for (TiledSurface::TileState& state : tiles.after) {
+                visit(state.image);
+            }
+        }
+    }
+
     HistoryState::HistoryState(std::shared_ptr<Document> document)
         : m_document(document)
+        , m_resident(true)
+    {
+    }
+
+    HistoryState::HistoryState(std::shared_ptr<HistoryCommand> command)
+        : m_command(command)
+        , m_resident(true)
     {
     }
 
     HistoryState::~HistoryState() = default;
 
+    void HistoryState::setPagedOut(std::vector<qint64> slotKeys)
+    {
+        m_slotKeys = std::move(slotKeys);
+        m_resident = false;
+    }
+
+    void HistoryState::setPagedIn()
+    {
+        m_slotKeys.clear();
+        m_resident = true;
+    }
+
     HistoryManager::HistoryManager(QObject* parent)
         : QObject(parent)
         , m_currentIndex(-1)
+        , m_undoBlocked(false)
+        , m_redoBlocked(false)
+        , m_memoryBudget(DefaultMemoryBudget)
+        , m_diskBudget(DefaultDiskBudget)
+        , m_memoryUsage(0)
+        , m_unstoredBytes(0)
     {
     }
 
     HistoryManager::~HistoryManager() = default;
 
-    void HistoryManager::pushState(std::shared_ptr<Document> document, const QString& description)
+    void HistoryManager::pushState(const Document& document, const QString& description)
     {
         // Remove any states after current index (when undoing then making new changes)
-        if (m_currentIndex < static_cast<int>(m_states.size()) - 1) {
-            m_states.erase(m_states.begin() + m_currentIndex + 1, m_states.end());
+        while (m_currentIndex < static_cast<int>(m_states.size()) - 1) {
+            removeState(static_cast<int>(m_states.size()) - 1);
         }
 
-        // Create deep copy of document
-        auto docCopy = std::make_shared<Document>(document->getSize().width(), document->getSize().height());
-        docCopy->setBackgroundColor(document->getBackgroundColor());
+        // Tiles are shared with the live document; only the ones the next
+        // operation writes get copied, by whichever side writes them
+        auto state = std::make_shared<HistoryState>(document.clone());
+        state->setDescription(description);
         
-        // Copy all layers
-        for (int i = 0; i < document->getLayerCount(); ++i) {
-            auto layer = document->getLayer(i);
-            auto layerCopy = std::make_shared<Layer>(layer->getName(), layer->getImage().copy());
-            layerCopy->setOpacity(layer->getOpacity());
-            layerCopy->setBlendMode(layer->getBlendMode());
-            layerCopy->setVisible(layer->isVisible());
-            layerCopy->setLocked(layer->isLocked());
-            layerCopy->setOffset(layer->getOffset());
-            docCopy->addLayer(layerCopy);
+        retain(*state);
+        m_states.push_back(state);
+        m_currentIndex = static_cast<int>(m_states.size()) - 1;
+        m_undoBlocked = false;
+        m_redoBlocked = false;
+
+        enforceBudget();
+
+        emit historyChanged();
+    }
+
+    void HistoryManager::pushCommand(const Document& document, std::shared_ptr<HistoryCommand> command,
+                                     const QString& description)
+    {
+        if (m_states.empty()) {
+            // The document as it was before the command becomes the first snapshot
+            auto base = document.clone();
+            command->undo(*base);
+            pushState(*base);
         }
-        
-        if (document->getLayerCount() > 0) {
-            docCopy->setActiveLayer(docCopy->getLayer(document->getLayerCount() - 1));
+
+        while (m_currentIndex < static_cast<int>(m_states.size()) - 1) {
+            removeState(static_cast<int>(m_states.size()) - 1);
+        }
+
+        HistoryState& current = *m_states[m_currentIndex];
+        if (current.getCommand() && current.getDescription() == description) {
+            // The current state is always resident; its blocks are
+            // counted again after the merge
+            const HistoryState previous = current;
+            if (current.getCommand()->mergeWith(*command)) {
+                retain(current);
+                release(previous);
+                enforceBudget();
+                emit historyChanged();
+                return;
+            }
         }
 
-        auto state = std::make_shared<HistoryState>(docCopy);
+        auto state = std::make_shared<HistoryState>(command);
         state->setDescription(description);
-        
+        retain(*state);
         m_states.push_back(state);
         m_currentIndex = static_cast<int>(m_states.size()) - 1;
+        m_undoBlocked = false;
+        m_redoBlocked = false;
 
-        // Limit history size
-        if (static_cast<int>(m_states.size()) > MAX_HISTORY_STATES) {
-            m_states.erase(m_states.begin());
-            m_currentIndex--;
-        }
+        enforceBudget();
 
         emit historyChanged();
     }
 
-    std::shared_ptr<Document> HistoryManager::undo()
+    bool HistoryManager::undo(Document& document)
     {
-        if (!canUndo()) return nullptr;
+        if (!canUndo()) return false;
         
+        HistoryState& state = *m_states[m_currentIndex];
+        const bool loaded = state.getCommand() ? pageIn(state) : restoreTo(document, m_currentIndex - 1);
+        if (!loaded) {
+            m_undoBlocked = true;
+            emit historyChanged();
+            return false;
+        }
+        if (state.getCommand()) {
+            state.getCommand()->undo(document);
+        }
         m_currentIndex--;
+        m_redoBlocked = false;
+        enforceMemoryBudget();
         emit historyChanged();
-        return m_states[m_currentIndex]->getDocument();
+        return true;
     }
 
-    std::shared_ptr<Document> HistoryManager::redo()
+    bool HistoryManager::redo(Document& document)
     {
-        if (!canRedo()) return nullptr;
+        if (!canRedo()) return false;
         
+        HistoryState& state = *m_states[m_currentIndex + 1];
+        if (!pageIn(state)) {
+            m_redoBlocked = true;
+            emit historyChanged();
+            return false;
+        }
+        if (state.getCommand()) {
+            state.getCommand()->redo(document);
+        } else {
+            document.restore(*state.getDocument());
+        }
         m_currentIndex++;
+        m_undoBlocked = false;
+        enforceMemoryBudget();
         emit historyChanged();
-        return m_states[m_currentIndex]->getDocument();
+        return true;
+    }
+
+    bool HistoryManager::restoreTo(Document& document, int index)
+    {
+        // The nearest snapshot at or before index, then the commands since,
+        // all read back before the document is touched
+        int base = index;
+        while (m_states[base]->getCommand()) {
+            --base;
+        }
+        for (int i = base; i <= index; ++i) {
+            if (!pageIn(*m_states[i])) return false;
+        }
+        document.restore(*m_states[base]->getDocument());
+        for (int i = base + 1; i <= index; ++i) {
+            m_states[i]->getCommand()->redo(document);
+        }
+        return true;
     }
 
     void HistoryManager::clear()
     {
         m_states.clear();
+        m_blockUses.clear();
+        m_aliases.clear();
+        m_store.clear();
+        m_memoryUsage = 0;
+        m_unstoredBytes = 0;
         m_currentIndex = -1;
+        m_undoBlocked = false;
+        m_redoBlocked = false;
         emit historyChanged();
     }
 
@@ -93,5 +355,287 @@ namespace LibreCanvas {
         return "";
     }
 
+    void HistoryManager::setMemoryBudget(qint64 bytes)
+    {
+        m_memoryBudget = std::max<qint64>(0, bytes);
+        const size_t count = m_states.size();
+        enforceBudget();
+        if (m_states.size() != count) {
+            emit historyChanged();
+        }
+    }
+
+    void HistoryManager::setDiskBudget(qint64 bytes)
+    {
+        m_diskBudget = std::max<qint64>(0, bytes);
+        const size_t count = m_states.size();
+        enforceBudget();
+        if (m_states.size() != count) {
+            emit historyChanged();
+        }
+    }
+
+    qint64 HistoryManager::getStateMemory(int index) const
+    {
+        if (index < 0 || index >= static_cast<int>(m_states.size())) return 0;
+        if (!m_states[index]->isResident()) return 0;
+
+        qint64 bytes = 0;
+        for (const HistoryBlock& block : m_states[index]->getBlocks()) {
+            if (m_blockUses.at(block.key).resident == 1) {
+                bytes += block.bytes;
+            }
+        }
+        return bytes;
+    }
+
+    bool HistoryManager::isStateResident(int index) const
+    {
+        return index >= 0 && index < static_cast<int>(m_states.size()) && m_states[index]->isResident();
+    }
+
+    qint64 HistoryManager::canonicalKey(qint64 key) const
+    {
+        // Pixels paged back in live in a new buffer; they still count as
+        // the block they were stored as
+        auto it = m_aliases.find(key);
+        return it != m_aliases.end() ? it->second : key;
+    }
+
+    void HistoryManager::retain(HistoryState& state)
+    {
+        std::vector<HistoryBlock> blocks;
+        std::unordered_set<qint64> seen;
+        forEachImage(state, [&](QImage& image) {
+            // The cache key follows the shared pixel data, not the QImage handle
+            if (image.isNull()) return;
+            const qint64 key = canonicalKey(image.cacheKey());
+            if (!seen.insert(key).second) return;
+
+            const qint64 bytes = static_cast<qint64>(image.sizeInBytes());
+            blocks.push_back({ key, bytes });
+            auto it = m_blockUses.find(key);
+            if (it == m_blockUses.end()) {
+                it = m_blockUses.emplace(key, BlockUse{ bytes, 0, 0, image, 0, false }).first;
+            }
+            BlockUse& use = it->second;
+            ++use.states;
+            if (use.resident++ == 0) {
+                use.image = image;
+                if (!use.unstored) {
+                    m_memoryUsage += bytes;
+                }
+            }
+        });
+        state.setBlocks(std::move(blocks));
+    }
+
+    void HistoryManager::release(const HistoryState& state)
+    {
+        for (const HistoryBlock& block : state.getBlocks()) {
+            if (state.isResident()) {
+                releaseResident(block);
+            }
+            auto it = m_blockUses.find(block.key);
+            if (--it->second.states == 0) {
+                if (it->second.alias != 0) {
+                    m_aliases.erase(it->second.alias);
+                }
+                if (it->second.unstored) {
+                    m_memoryUsage -= it->second.bytes;
+                    m_unstoredBytes -= it->second.bytes;
+                }
+                m_store.remove(block.key);
+                m_blockUses.erase(it);
+            }
+        }
+    }
+
+    void HistoryManager::releaseResident(const HistoryBlock& block)
+    {
+        BlockUse& use = m_blockUses.at(block.key);
+        if (--use.resident == 0) {
+            use.image = QImage();
+            // Unstored blocks stay in memory in the store
+            if (!use.unstored) {
+                m_memoryUsage -= use.bytes;
+            }
+        }
+    }
+
+    void HistoryManager::pageOut(HistoryState& state)
+    {
+        // Everything goes to the store, even blocks other resident states
+        // still hold, since those may be dropped before this state returns
+        std::vector<qint64> slotKeys;
+        std::vector<std::pair<qint64, QImage>> images;
+        forEachImage(state, [&](QImage& image) {
+            if (image.isNull()) {
+                slotKeys.push_back(0);
+                return;
+            }
+            const qint64 key = canonicalKey(image.cacheKey());
+            slotKeys.push_back(key);
+            images.emplace_back(key, image);
+            image = QImage();
+        });
+        m_store.write(images);
+
+        for (const HistoryBlock& block : state.getBlocks()) {
+            releaseResident(block);
+        }
+        state.setPagedOut(std::move(slotKeys));
+    }
+
+    void HistoryManager::collectFailedWrites()
+    {
+        for (qint64 key : m_store.takeFailedWrites()) {
+            auto it = m_blockUses.find(key);
+            if (it == m_blockUses.end() || it->second.unstored) continue;
+            BlockUse& use = it->second;
+            use.unstored = true;
+            m_unstoredBytes += use.bytes;
+            // Paged-out blocks had stopped counting; the store still holds them
+            if (use.resident == 0) {
+                m_memoryUsage += use.bytes;
+            }
+        }
+    }
+
+    bool HistoryManager::pageIn(HistoryState& state)
+    {
+        if (state.isResident()) return true;
+
+        // Blocks still held by a resident neighbour are shared again;
+        // only the rest are read back, each once. Every block is loaded
+        // before any slot is filled, so a failed read leaves the state
+        // paged out and counted as it was.
+        const std::vector<qint64>& slotKeys = state.getSlotKeys();
+        std::vector<HistoryBlock> loaded;
+        std::unordered_set<qint64> seen;
+        for (qint64 key : slotKeys) {
+            if (key == 0 || !seen.insert(key).second) continue;
+
+            BlockUse& use = m_blockUses.at(key);
+            if (use.resident == 0) {
+                QImage image;
+                if (!m_store.read(key, image)) {
+                    for (const HistoryBlock& block : loaded) {
+                        releaseResident(block);
+                    }
+                    return false;
+                }
+                use.image = image;
+                if (!use.unstored) {
+                    m_memoryUsage += use.bytes;
+                }
+                if (use.alias != 0) {
+                    m_aliases.erase(use.alias);
+                }
+                use.alias = use.image.cacheKey() != key ? use.image.cacheKey() : 0;
+                if (use.alias != 0) {
+                    m_aliases[use.alias] = key;
+                }
+            }
+            ++use.resident;
+            loaded.push_back({ key, use.bytes });
+        }
+
+        size_t slot = 0;
+        forEachImage(state, [&](QImage& image) {
+            const qint64 key = slotKeys[slot++];
+            if (key != 0) {
+                image = m_blockUses.at(key).image;
+            }
+        });
+        state.setPagedIn();
+        return true;
+    }
+
+    void HistoryManager::removeState(int index)
+    {
+        release(*m_states[index]);
+        m_states.erase(m_states.begin() + index);
+        if (index <= m_currentIndex) {
+            m_currentIndex--;
+        }
+    }
+
+    bool HistoryManager::dropOldestState()
+    {
+        if (m_states.size() > 1 && m_states[1]->getCommand()) {
+            // A command needs a snapshot before it; apply it to the oldest
+            // one instead, then account for the tiles that now holds
+            HistoryState& base = *m_states[0];
+            HistoryState& command = *m_states[1];
+            if (!pageIn(base) || !pageIn(command)) return false;
+            command.getCommand()->redo(*base.getDocument());
+            base.setDescription(command.getDescription());
+
+            const HistoryState previous = base;
+            retain(base);
+            release(previous);
+            release(command);
+            m_states.erase(m_states.begin() + 1);
+            m_currentIndex--;
+            return true;
+        }
+        // The next state already holds everything after this step
+        removeState(0);
+        return true;
+    }
+
+    void HistoryManager::enforceMemoryBudget()
+    {
+        // Page out the resident states farthest from the current one, so
+        // stepping back or forth nearby rarely waits on the disk
+        while (m_memoryUsage > m_memoryBudget) {
+            int farthest = -1;
+            for (int i = 0; i < static_cast<int>(m_states.size()); ++i) {
+                if (i == m_currentIndex || !m_states[i]->isResident()) continue;
+                if (farthest < 0 || std::abs(i - m_currentIndex) > std::abs(farthest - m_currentIndex)) {
+                    farthest = i;
+                }
+            }
+            if (farthest < 0) break;
+            pageOut(*m_states[farthest]);
+        }
+    }
+
+    void HistoryManager::enforceBudget()
+    {
+        collectFailedWrites();
+        enforceMemoryBudget();
+
+        // Blocks the scratch file could not take only leave memory with
+        // the states holding them, oldest steps first, then redo steps
+        while (m_memoryUsage > m_memoryBudget && m_unstoredBytes > 0 && m_states.size() > 1) {
+            if (m_currentIndex > 0) {
+                if (!dropOldestState()) break;
+            } else {
+                removeState(static_cast<int>(m_states.size()) - 1);
+            }
+        }
+
+        // Dropped states leave holes in the scratch file until it is
+        // compacted, so drop until what is left fits, then compact once
+        if (m_store.getDiskUsage() > m_diskBudget) {
+            while (m_store.getStoredBytes() > m_diskBudget && m_states.size() > 1) {
+                if (m_currentIndex > 0) {
+                    // Steps that cannot be read back cannot be folded
+                    // either; keep them rather than lose the snapshot
+                    if (!dropOldestState()) break;
+                } else {
+                    removeState(static_cast<int>(m_states.size()) - 1);
+                }
+            }
+            m_store.compact();
+        }
+
+        // Folding the oldest steps pages them back in; page them out again
+        // if that went over the memory budget
+        enforceMemoryBudget();
+    }
+
 } // namespace LibreCanvas
 
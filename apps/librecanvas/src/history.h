@@ -2,52 +2,220 @@
 
 #include <QObject>
 #include <QImage>
+#include <functional>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 #include "document.h"
+#include "historystore.h"
 
 namespace LibreCanvas {
 
+    // A pixel buffer a history state keeps alive. Buffers shared between
+    // states, or with the document, carry the same key.
+    struct HistoryBlock {
+        qint64 key;
+        qint64 bytes;
+    };
+
+    // A history step kept as the change itself rather than a snapshot.
+    // Both directions find their target by id, since undoing a snapshot
+    // replaces the document's layer objects.
+    class HistoryCommand {
+    public:
+        virtual ~HistoryCommand() = default;
+        virtual void undo(Document& document) = 0;
+        virtual void redo(Document& document) = 0;
+        // Folds next, recorded right after this one, into this step
+        virtual bool mergeWith(const HistoryCommand& next) { return false; }
+        // Pixel buffers the command holds, in a fixed order, so history can
+        // account for them and page them out like snapshot tiles
+        virtual void forEachImage(const std::function<void(QImage&)>& visit) {}
+    };
+
+    // What a layer looks like in the stack, apart from its pixels
+    struct LayerProperties {
+        QString name;
+        bool visible = true;
+        float opacity = 1.0f;
+        BlendMode blendMode = BlendMode::Normal;
+        QPoint offset;
+
+        static LayerProperties of(const Layer& layer);
+        void applyTo(Layer& layer) const;
+        bool operator==(const LayerProperties& other) const;
+        bool operator!=(const LayerProperties& other) const { return !(*this == other); }
+    };
+
+    // Visibility, opacity, blend mode, name or offset of one layer
+    class LayerPropertyCommand : public HistoryCommand {
+    public:
+        LayerPropertyCommand(quint64 layerId, const LayerProperties& before, const LayerProperties& after);
+
+        void undo(Document& document) override;
+        void redo(Document& document) override;
+        // Consecutive edits of the same properties of a layer, such as a
+        // slider drag, are one step
+        bool mergeWith(const HistoryCommand& next) override;
+
+    private:
+        int changedFields() const;
+
+        quint64 m_layerId;
+        LayerProperties m_before;
+        LayerProperties m_after;
+    };
+
+    // A pixel edit as the tiles it changed, before and after, per layer
+    class TileEditCommand : public HistoryCommand {
+    public:
+        struct LayerTiles {
+            quint64 layerId;
+            std::vector<TiledSurface::TileState> before;
+            std::vector<TiledSurface::TileState> after;
+        };
+
+        explicit TileEditCommand(std::vector<LayerTiles> layers);
+
+        void undo(Document& document) override;
+        void redo(Document& document) override;
+        void forEachImage(const std::function<void(QImage&)>& visit) override;
+
+    private:
+        std::vector<LayerTiles> m_layers;
+    };
+
+    // One history step: either the document as it was afterwards, or a
+    // command that leads there from the step before
     class HistoryState {
     public:
         HistoryState(std::shared_ptr<Document> document);
+        HistoryState(std::shared_ptr<HistoryCommand> command);
         ~HistoryState();
         
+        // Null for command steps
         std::shared_ptr<Document> getDocument() const { return m_document; }
+        std::shared_ptr<HistoryCommand> getCommand() const { return m_command; }
         QString getDescription() const { return m_description; }
         void setDescription(const QString& desc) { m_description = desc; }
 
+        // Every tile and mask of the stored document, each listed once
+        const std::vector<HistoryBlock>& getBlocks() const { return m_blocks; }
+        void setBlocks(std::vector<HistoryBlock> blocks) { m_blocks = std::move(blocks); }
+
+        // A paged-out state keeps its layers but not their pixels; the
+        // keys say which stored block goes back into each image slot
+        bool isResident() const { return m_resident; }
+        const std::vector<qint64>& getSlotKeys() const { return m_slotKeys; }
+        void setPagedOut(std::vector<qint64> slotKeys);
+        void setPagedIn();
+
     private:
         std::shared_ptr<Document> m_document;
+        std::shared_ptr<HistoryCommand> m_command;
         QString m_description;
+        std::vector<HistoryBlock> m_blocks;
+        bool m_resident;
+        std::vector<qint64> m_slotKeys;
     };
 
+    // Undo steps. Snapshots share unchanged tiles with each other and the
+    // document; commands keep only what an edit changed, such as layer
+    // properties or the tiles a stroke touched, and only touch those when
+    // undone. The oldest step is always a snapshot.
+    // States stay in memory while the memory budget allows. Past it, the
+    // states farthest from the current one are compressed to a scratch
+    // file in the background and paged back in when undo or redo reaches
+    // them. Disk over budget drops the oldest states, folding their step
+    // into the next one, then redo states, furthest first. The current
+    // state is always kept.
     class HistoryManager : public QObject {
         Q_OBJECT
 
     public:
+        static constexpr qint64 DefaultMemoryBudget = qint64(1024) * 1024 * 1024;
+        static constexpr qint64 DefaultDiskBudget = qint64(8) * 1024 * 1024 * 1024;
+
         HistoryManager(QObject* parent = nullptr);
         ~HistoryManager();
 
-        void pushState(std::shared_ptr<Document> document, const QString& description = "");
-        bool canUndo() const { return m_currentIndex > 0; }
-        bool canRedo() const { return m_currentIndex < static_cast<int>(m_states.size()) - 1; }
+        void pushState(const Document& document, const QString& description = "");
+        // Records a command already applied to document; with no history
+        // yet, the document from before it is snapshotted first
+        void pushCommand(const Document& document, std::shared_ptr<HistoryCommand> command,
+                         const QString& description = "");
+        bool canUndo() const { return m_currentIndex > 0 && !m_undoBlocked; }
+        bool canRedo() const { return m_currentIndex < static_cast<int>(m_states.size()) - 1 && !m_redoBlocked; }
         
-        std::shared_ptr<Document> undo();
-        std::shared_ptr<Document> redo();
+        // Step the document back or forth; false when there is nowhere to go.
+        // A step whose pixels cannot be read back from the scratch file
+        // leaves the document as it is and blocks that direction until
+        // the history changes.
+        bool undo(Document& document);
+        bool redo(Document& document);
         
         void clear();
         int getHistorySize() const { return static_cast<int>(m_states.size()); }
         int getCurrentIndex() const { return m_currentIndex; }
         QString getCurrentDescription() const;
 
+        // Memory accounting, in bytes of pixel data. Usage counts each
+        // buffer held by a resident state once however many states share
+        // it, plus blocks the scratch file could not take; a state's own
+        // memory is what dropping it would free.
+        qint64 getMemoryBudget() const { return m_memoryBudget; }
+        void setMemoryBudget(qint64 bytes);
+        qint64 getMemoryUsage() const { return m_memoryUsage; }
+        qint64 getStateMemory(int index) const;
+        bool isStateResident(int index) const;
+
+        // Size of the scratch file, holes left by dropped states included
+        qint64 getDiskBudget() const { return m_diskBudget; }
+        void setDiskBudget(qint64 bytes);
+        qint64 getDiskUsage() const { return m_store.getDiskUsage(); }
+
     signals:
         void historyChanged();
 
     private:
+        struct BlockUse {
+            qint64 bytes;
+            // States holding the block, and how many of them are in memory
+            int states;
+            int resident;
+            // The pixels, while any resident state holds them
+            QImage image;
+            // Cache key of the copy paged back in, if it differs
+            qint64 alias;
+            // The scratch file could not take the block, so the store holds
+            // it in memory for as long as any state does
+            bool unstored;
+        };
+
+        qint64 canonicalKey(qint64 key) const;
+        void retain(HistoryState& state);
+        void release(const HistoryState& state);
+        void releaseResident(const HistoryBlock& block);
+        void pageOut(HistoryState& state);
+        void collectFailedWrites();
+        bool pageIn(HistoryState& state);
+        bool restoreTo(Document& document, int index);
+        void removeState(int index);
+        bool dropOldestState();
+        void enforceMemoryBudget();
+        void enforceBudget();
+
         std::vector<std::shared_ptr<HistoryState>> m_states;
         int m_currentIndex;
-        static const int MAX_HISTORY_STATES = 50;
+        bool m_undoBlocked;
+        bool m_redoBlocked;
+        qint64 m_memoryBudget;
+        qint64 m_diskBudget;
+        qint64 m_memoryUsage;
+        qint64 m_unstoredBytes;
+        std::unordered_map<qint64, BlockUse> m_blockUses;
+        std::unordered_map<qint64, qint64> m_aliases;
+        HistoryStore m_store;
     };
 
 } // namespace LibreCanvas
@@ -0,0 +1,207 @@
+#include "historystore.h"
+#include <QDir>
+#include <QMutexLocker>
+#include <algorithm>
+#include <cstring>
+
+namespace LibreCanvas {
+
+    // Fast zlib level; tiles are mostly flat color or empty space
+    static constexpr int CompressionLevel = 1;
+    // Holes are compacted once they exceed both this and the stored data,
+    // so the file stays under twice its contents and each byte is moved a
+    // bounded number of times
+    static constexpr qint64 MinimumCompactionBytes = 8 * 1024 * 1024;
+
+    HistoryStore::HistoryStore()
+        : m_file(QDir::temp().filePath("librecanvas-history-XXXXXX"))
+        , m_fileOpen(false)
+        , m_storedBytes(0)
+    {
+        // A single writer keeps appends ordered
+        m_writer.setMaxThreadCount(1);
+    }
+
+    HistoryStore::~HistoryStore()
+    {
+        m_writer.waitForDone();
+    }
+
+    void HistoryStore::write(const std::vector<std::pair<qint64, QImage>>& images)
+    {
+        std::vector<qint64> keys;
+        {
+            QMutexLocker locker(&m_mutex);
+            for (const auto& [key, image] : images) {
+                if (image.isNull() || m_pending.count(key) || m_entries.count(key)) continue;
+                // Held here until written; history itself may drop it right away
+                m_pending.emplace(key, image);
+                keys.push_back(key);
+            }
+        }
+        if (keys.empty()) return;
+
+        m_writer.start([this, keys = std::move(keys)]() mutable {
+            writePending(std::move(keys));
+        });
+    }
+
+    void HistoryStore::writePending(std::vector<qint64> keys)
+    {
+        for (qint64 key : keys) {
+            QImage image;
+            {
+                QMutexLocker locker(&m_mutex);
+                auto it = m_pending.find(key);
+                // Removed while waiting in the queue
+                if (it == m_pending.end()) continue;
+                image = it->second;
+            }
+
+            // Compress outside the lock; the image is only read
+            const QByteArray data = qCompress(image.constBits(), image.sizeInBytes(), CompressionLevel);
+
+            QMutexLocker locker(&m_mutex);
+            auto it = m_pending.find(key);
+            if (it == m_pending.end()) continue;
+            if (!m_fileOpen) {
+                m_fileOpen = m_file.open();
+            }
+            const qint64 offset = m_file.size();
+            if (!m_fileOpen || !m_file.seek(offset) || m_file.write(data) != data.size()) {
+                // Out of scratch space: the image stays in memory, and the
+                // history is told so it can count it there
+                m_failedWrites.push_back(key);
+                continue;
+            }
+            m_entries.emplace(key, Entry{ offset, data.size(), image.width(), image.height(), image.format() });
+            m_storedBytes += data.size();
+            m_pending.erase(it);
+        }
+    }
+
+    bool HistoryStore::contains(qint64 key) const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_pending.count(key) || m_entries.count(key);
+    }
+
+    bool HistoryStore::read(qint64 key, QImage& image) const
+    {
+        QByteArray data;
+        Entry entry;
+        {
+            QMutexLocker locker(&m_mutex);
+            auto pending = m_pending.find(key);
+            if (pending != m_pending.end()) {
+                image = pending->second;
+                return true;
+            }
+            auto it = m_entries.find(key);
+            if (it == m_entries.end()) return false;
+            entry = it->second;
+            if (!m_file.seek(entry.offset)) return false;
+            data = m_file.read(entry.size);
+            if (data.size() != entry.size) return false;
+        }
+
+        const QByteArray pixels = qUncompress(data);
+        QImage decoded(entry.width, entry.height, entry.format);
+        if (decoded.isNull() || pixels.size() != decoded.sizeInBytes()) return false;
+        std::memcpy(decoded.bits(), pixels.constData(), pixels.size());
+        image = decoded;
+        return true;
+    }
+
+    void HistoryStore::remove(qint64 key)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_pending.erase(key);
+        auto it = m_entries.find(key);
+        if (it == m_entries.end()) return;
+        m_storedBytes -= it->second.size;
+        m_entries.erase(it);
+
+        const qint64 holes = fileSizeLocked() - m_storedBytes;
+        if (m_entries.empty() || holes > std::max(m_storedBytes, MinimumCompactionBytes)) {
+            compactLocked();
+        }
+    }
+
+    void HistoryStore::clear()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_pending.clear();
+        m_entries.clear();
+        m_failedWrites.clear();
+        m_storedBytes = 0;
+        if (m_fileOpen) {
+            m_file.resize(0);
+        }
+    }
+
+    std::vector<qint64> HistoryStore::takeFailedWrites()
+    {
+        QMutexLocker locker(&m_mutex);
+        std::vector<qint64> keys;
+        keys.swap(m_failedWrites);
+        return keys;
+    }
+
+    void HistoryStore::compact()
+    {
+        QMutexLocker locker(&m_mutex);
+        if (fileSizeLocked() > m_storedBytes) {
+            compactLocked();
+        }
+    }
+
+    void HistoryStore::compactLocked()
+    {
+        if (!m_fileOpen) return;
+
+        std::vector<Entry*> entries;
+        entries.reserve(m_entries.size());
+        for (auto& [key, entry] : m_entries) {
+            entries.push_back(&entry);
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry* a, const Entry* b) {
+            return a->offset < b->offset;
+        });
+
+        // Each image moves down to the end of the previous one, so it never
+        // overwrites an image that has not moved yet
+        qint64 end = 0;
+        for (Entry* entry : entries) {
+            if (entry->offset != end) {
+                if (!m_file.seek(entry->offset)) return;
+                const QByteArray data = m_file.read(entry->size);
+                if (data.size() != entry->size || !m_file.seek(end) || m_file.write(data) != data.size()) {
+                    // Images not moved yet are still intact where they were
+                    return;
+                }
+                entry->offset = end;
+            }
+            end += entry->size;
+        }
+        m_file.resize(end);
+    }
+
+    qint64 HistoryStore::fileSizeLocked() const
+    {
+        return m_fileOpen ? m_file.size() : 0;
+    }
+
+    qint64 HistoryStore::getDiskUsage() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return fileSizeLocked();
+    }
+
+    qint64 HistoryStore::getStoredBytes() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_storedBytes;
+    }
+
+} // namespace LibreCanvas
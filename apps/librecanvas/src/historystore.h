@@ -0,0 +1,64 @@
+#pragma once
+
+#include <QImage>
+#include <QMutex>
+#include <QTemporaryFile>
+#include <QThreadPool>
+#include <unordered_map>
+#include <vector>
+
+namespace LibreCanvas {
+
+    // Scratch file that history pixels are paged out to. Images are keyed
+    // by their cache key, compressed and appended on a background thread,
+    // one job at a time. Until an image is on disk the store keeps it in
+    // memory, so reads never wait for the writer. Removed images leave
+    // holes that are compacted away once they outweigh the stored data.
+    class HistoryStore {
+    public:
+        HistoryStore();
+        ~HistoryStore();
+
+        // Queues the images that are not stored yet; returns immediately
+        void write(const std::vector<std::pair<qint64, QImage>>& images);
+        bool contains(qint64 key) const;
+        // Decompresses a stored image; false when the key is unknown or the
+        // file cannot give the image back
+        bool read(qint64 key, QImage& image) const;
+        void remove(qint64 key);
+        void clear();
+        // Moves the stored images together and truncates the file after them
+        void compact();
+        // Keys of images the file could not take since the last call. The
+        // store keeps those in memory, readable, until they are removed.
+        std::vector<qint64> takeFailedWrites();
+
+        // Size of the scratch file, holes included
+        qint64 getDiskUsage() const;
+        // Compressed bytes of the images still in the store
+        qint64 getStoredBytes() const;
+
+    private:
+        struct Entry {
+            qint64 offset;
+            qint64 size;
+            int width;
+            int height;
+            QImage::Format format;
+        };
+
+        void writePending(std::vector<qint64> keys);
+        void compactLocked();
+        qint64 fileSizeLocked() const;
+
+        mutable QMutex m_mutex;
+        mutable QTemporaryFile m_file;
+        bool m_fileOpen;
+        std::unordered_map<qint64, QImage> m_pending;
+        std::unordered_map<qint64, Entry> m_entries;
+        std::vector<qint64> m_failedWrites;
+        qint64 m_storedBytes;
+        QThreadPool m_writer;
+    };
+
+} // namespace LibreCanvas
@@ -1,25 +1,33 @@
 #include "layer.h"
+#include "pixeldepth.h"
 #include <QPainter>
-#include <QPainterPath>
 #include <algorithm>
+#include <atomic>
 
 namespace LibreCanvas {
 
-    Layer::Layer(const QString& name, int width, int height)
-        : m_name(name)
-        , m_image(width, height, QImage::Format_ARGB32)
+    static quint64 nextObjectId()
+    {
+        static std::atomic<quint64> counter(0);
+        return ++counter;
+    }
+
+    Layer::Layer(const QString& name, int width, int height, QImage::Format format)
+        : m_id(nextObjectId())
+        , m_name(name)
+        , m_surface(width, height, format)
         , m_offset(0, 0)
         , m_visible(true)
         , m_locked(false)
         , m_opacity(1.0f)
         , m_blendMode(BlendMode::Normal)
     {
-        m_image.fill(Qt::transparent);
     }
 
     Layer::Layer(const QString& name, const QImage& image)
-        : m_name(name)
-        , m_image(image.copy())
+        : m_id(nextObjectId())
+        , m_name(name)
+        , m_surface(image)
         , m_offset(0, 0)
         , m_visible(true)
         , m_locked(false)
@@ -30,37 +38,163 @@ namespace LibreCanvas {
 
     Layer::~Layer() = default;
 
+    void Layer::setVisible(bool visible)
+    {
+        if (m_visible == visible) return;
+        m_visible = visible;
+        markAllDirty();
+    }
+
+    void Layer::setOpacity(float opacity)
+    {
+        opacity = qBound(0.0f, opacity, 1.0f);
+        if (m_opacity == opacity) return;
+        m_opacity = opacity;
+        markAllDirty();
+    }
+
+    void Layer::setBlendMode(BlendMode mode)
+    {
+        if (m_blendMode == mode) return;
+        m_blendMode = mode;
+        markAllDirty();
+    }
+
+    void Layer::setOffset(const QPoint& offset)
+    {
+        if (m_offset == offset) return;
+        markAllDirty();
+        m_offset = offset;
+        markAllDirty();
+    }
+
+    void Layer::paint(const QRect& area, const std::function<void(QPainter&)>& painterFunction)
+    {
+        m_surface.paint(area, painterFunction);
+        markDirty(area);
+    }
+
+    void Layer::drawDabs(const std::vector<TiledSurface::Dab>& dabs, const QColor& color, float opacity,
+                         LibreEffects::Core::BlendSpace space)
+    {
+        markDirty(m_surface.drawDabs(dabs, color, opacity, space));
+    }
+
+    void Layer::eraseDabs(const std::vector<TiledSurface::Dab>& dabs, float opacity)
+    {
+        markDirty(m_surface.eraseDabs(dabs, opacity));
+    }
+
+    void Layer::setImage(const QImage& image)
+    {
+        markAllDirty();
+        m_surface.setImage(image);
+        markAllDirty();
+    }
+
+    void Layer::convertToFormat(QImage::Format format)
+    {
+        if (m_surface.getFormat() == format) return;
+        m_surface.convertToFormat(format);
+        markAllDirty();
+    }
+
+    bool Layer::occludes(const QRect& area) const
+    {
+        return m_visible && m_opacity >= 1.0f && m_blendMode == BlendMode::Normal && m_mask.isNull()
+               && m_surface.isOpaque(area.translated(-m_offset));
+    }
+
+    void Layer::restoreTiles(const std::vector<TiledSurface::TileState>& tiles)
+    {
+        // Old and new content both sit inside the tile
+        m_surface.restoreTiles(tiles);
+        for (const TiledSurface::TileState& state : tiles) {
+            markDirty(m_surface.tileRect(state.column, state.row));
+        }
+    }
+
+    void Layer::markDirty(const QRect& layerRect)
+    {
+        QRect clipped = layerRect.intersected(m_surface.rect());
+        if (!clipped.isEmpty()) {
+            m_dirtyRegion += clipped.translated(m_offset);
+        }
+    }
+
+    QRegion Layer::takeDirtyRegion()
+    {
+        QRegion region = m_dirtyRegion;
+        m_dirtyRegion = QRegion();
+        return region;
+    }
+
+    std::shared_ptr<Layer> Layer::takeSnapshot()
+    {
+        auto copy = std::make_shared<Layer>(*this);
+        m_dirtyRegion = QRegion();
+        return copy;
+    }
+
+    void Layer::assign(const Layer& other)
+    {
+        QRegion dirty = m_dirtyRegion + other.m_dirtyRegion;
+        *this = other;
+        m_dirtyRegion = dirty;
+    }
+
+    std::shared_ptr<Layer> Layer::clone() const
+    {
+        auto copy = std::make_shared<Layer>(*this);
+        copy->m_dirtyRegion = QRegion();
+        return copy;
+    }
+
     void Layer::createMask()
     {
-        m_mask = QImage(m_image.size(), QImage::Format_Grayscale8);
+        m_mask = QImage(m_surface.getSize(), QImage::Format_Grayscale8);
         m_mask.fill(Qt::white); // White = visible, Black = hidden
+        markAllDirty();
     }
 
     void Layer::deleteMask()
     {
         m_mask = QImage();
+        markAllDirty();
     }
 
     void Layer::applyMask()
     {
         if (m_mask.isNull()) return;
 
-        QImage masked = m_image.copy();
-        for (int y = 0; y < masked.height(); ++y) {
-            for (int x = 0; x < masked.width(); ++x) {
-                QColor pixel = masked.pixelColor(x, y);
-                int maskValue = qGray(m_mask.pixel(x, y));
-                pixel.setAlpha(pixel.alpha() * maskValue / 255);
-                masked.setPixelColor(x, y, pixel);
+        for (int row = 0; row < m_surface.getRows(); ++row) {
+            for (int column = 0; column < m_surface.getColumns(); ++column) {
+                if (!m_surface.hasTile(column, row)) continue;
+                maskTile(m_surface.tileForWrite(column, row), m_surface.tileRect(column, row));
             }
         }
-        m_image = masked;
+        m_surface.updateContentBounds(m_surface.rect());
         m_mask = QImage(); // Clear mask after applying
+        markAllDirty();
+    }
+
+    void Layer::maskTile(QImage& tile, const QRect& bounds) const
+    {
+        const bool straight = tile.format() == QImage::Format_ARGB32;
+        const auto format = corePixelFormat(tile.format());
+        for (int y = 0; y < bounds.height(); ++y) {
+            const uint8_t* mask = m_mask.constScanLine(bounds.y() + y) + bounds.x();
+            if (straight) {
+                LibreEffects::Core::maskAlphaRow(reinterpret_cast<uint32_t*>(tile.scanLine(y)), mask, bounds.width());
+            } else {
+                LibreEffects::Core::maskPremultipliedRow(format, tile.scanLine(y), mask, bounds.width());
+            }
+        }
     }
 
-    void Layer::render(QPainter& painter, const QRect& destRect) const
+    void Layer::render(QPainter& painter, const QRect& destRect, const QRect& exposedRect) const
     {
-        if (!m_visible || m_image.isNull()) return;
+        if (!m_visible || m_surface.isNull()) return;
 
         painter.save();
 
@@ -71,22 +205,31 @@ namespace LibreCanvas {
         applyBlendMode(painter);
 
         // Apply offset
-        QRect sourceRect = m_image.rect();
-        QRect targetRect = destRect.translated(m_offset);
+        QRect targetRect = QRect(destRect.topLeft() + m_offset, m_surface.getSize());
 
-        // Apply mask if present
-        if (!m_mask.isNull()) {
-            QPainterPath clipPath;
-            QImage maskScaled = m_mask.scaled(targetRect.size(), Qt::KeepAspectRatio, Qt::SmoothTransformation);
-            // Create clipping path from mask
-            // For now, simple alpha channel masking
-            painter.setCompositionMode(QPainter::CompositionMode_DestinationIn);
-            painter.drawImage(targetRect, maskScaled);
-            painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        }
+        // Draw the layer tiles that hold content inside the destination
+        QRect visibleRect = destRect.intersected(exposedRect).translated(-targetRect.topLeft())
+                                .intersected(m_surface.getContentBounds());
+        int firstColumn, firstRow, lastColumn, lastRow;
+        if (m_surface.tileRange(visibleRect, firstColumn, firstRow, lastColumn, lastRow)) {
+            for (int row = firstRow; row <= lastRow; ++row) {
+                for (int column = firstColumn; column <= lastColumn; ++column) {
+                    if (!m_surface.tileContentBounds(column, row).intersects(visibleRect)) continue;
+                    QRect bounds = m_surface.tileRect(column, row);
+                    QPoint tilePos = targetRect.topLeft() + bounds.topLeft();
+                    if (m_mask.isNull()) {
+                        painter.drawImage(tilePos, m_surface.tile(column, row));
+                        continue;
+                    }
 
-        // Draw the layer image
-        painter.drawImage(targetRect, m_image, sourceRect);
+                    // Mask a copy of the tile so only this layer's alpha is
+                    // affected, not what was painted underneath
+                    QImage masked = m_surface.tile(column, row).copy();
+                    maskTile(masked, bounds);
+                    painter.drawImage(tilePos, masked);
+                }
+            }
+        }
 
         painter.restore();
     }
@@ -135,38 +278,180 @@ namespace LibreCanvas {
 
     // LayerGroup implementation
     LayerGroup::LayerGroup(const QString& name)
-        : m_name(name)
+        : m_id(nextObjectId())
+        , m_name(name)
         , m_visible(true)
         , m_expanded(true)
+        , m_opacity(1.0f)
+        , m_blendMode(BlendMode::Normal)
+        , m_passThrough(false)
     {
     }
 
     LayerGroup::~LayerGroup() = default;
 
+    void LayerGroup::setVisible(bool visible)
+    {
+        if (m_visible == visible) return;
+        m_visible = visible;
+        m_dirtyRegion += getContentBounds();
+    }
+
+    void LayerGroup::setOpacity(float opacity)
+    {
+        opacity = qBound(0.0f, opacity, 1.0f);
+        if (m_opacity == opacity) return;
+        m_opacity = opacity;
+        m_dirtyRegion += getContentBounds();
+    }
+
+    void LayerGroup::setBlendMode(BlendMode mode)
+    {
+        if (m_blendMode == mode) return;
+        m_blendMode = mode;
+        m_dirtyRegion += getContentBounds();
+    }
+
+    void LayerGroup::setPassThrough(bool passThrough)
+    {
+        if (m_passThrough == passThrough) return;
+        m_passThrough = passThrough;
+        m_dirtyRegion += getContentBounds();
+    }
+
+    QRect LayerGroup::getContentBounds() const
+    {
+        QRect bounds;
+        for (const auto& layer : m_layers) {
+            bounds = bounds.united(layer->getContentBounds());
+        }
+        for (const auto& group : m_groups) {
+            bounds = bounds.united(group->getContentBounds());
+        }
+        return bounds;
+    }
+
+    QRegion LayerGroup::takeDirtyRegion()
+    {
+        QRegion childDirty;
+        for (const auto& layer : m_layers) {
+            childDirty += layer->takeDirtyRegion();
+        }
+        for (const auto& group : m_groups) {
+            childDirty += group->takeDirtyRegion();
+        }
+        m_cache.valid -= childDirty + m_staleRegion;
+
+        QRegion region = m_dirtyRegion + childDirty;
+        m_dirtyRegion = QRegion();
+        m_staleRegion = QRegion();
+        return region;
+    }
+
+    QRegion LayerGroup::getPendingRegion() const
+    {
+        QRegion region = m_dirtyRegion;
+        for (const auto& layer : m_layers) {
+            region += layer->getDirtyRegion();
+        }
+        for (const auto& group : m_groups) {
+            region += group->getPendingRegion();
+        }
+        return region;
+    }
+
+    std::shared_ptr<LayerGroup> LayerGroup::takeSnapshot()
+    {
+        // This group's own cache must still forget what changed
+        m_cache.valid -= getPendingRegion() + m_staleRegion;
+
+        auto copy = std::make_shared<LayerGroup>(m_name);
+        copy->m_id = m_id;
+        copy->m_visible = m_visible;
+        copy->m_expanded = m_expanded;
+        copy->m_opacity = m_opacity;
+        copy->m_blendMode = m_blendMode;
+        copy->m_passThrough = m_passThrough;
+        copy->m_dirtyRegion = m_dirtyRegion;
+        copy->m_staleRegion = m_staleRegion;
+        for (const auto& layer : m_layers) {
+            copy->m_layers.push_back(layer->takeSnapshot());
+        }
+        for (const auto& group : m_groups) {
+            copy->m_groups.push_back(group->takeSnapshot());
+        }
+        m_dirtyRegion = QRegion();
+        m_staleRegion = QRegion();
+        return copy;
+    }
+
+    void LayerGroup::assign(const LayerGroup& other, std::vector<std::shared_ptr<Layer>> layers,
+                            std::vector<std::shared_ptr<LayerGroup>> groups)
+    {
+        m_id = other.m_id;
+        m_name = other.m_name;
+        m_visible = other.m_visible;
+        m_expanded = other.m_expanded;
+        m_opacity = other.m_opacity;
+        m_blendMode = other.m_blendMode;
+        m_passThrough = other.m_passThrough;
+        m_dirtyRegion += other.m_dirtyRegion;
+        m_staleRegion += other.m_staleRegion;
+        m_layers = std::move(layers);
+        m_groups = std::move(groups);
+    }
+
+    std::shared_ptr<LayerGroup> LayerGroup::clone() const
+    {
+        auto copy = std::make_shared<LayerGroup>(m_name);
+        copy->m_id = m_id;
+        copy->m_visible = m_visible;
+        copy->m_expanded = m_expanded;
+        copy->m_opacity = m_opacity;
+        copy->m_blendMode = m_blendMode;
+        copy->m_passThrough = m_passThrough;
+        for (const auto& layer : m_layers) {
+            copy->m_layers.push_back(layer->clone());
+        }
+        for (const auto& group : m_groups) {
+            copy->m_groups.push_back(group->clone());
+        }
+        copy->markChildDirty(copy->getContentBounds());
+        return copy;
+    }
+
+    void LayerGroup::markChildDirty(const QRect& rect)
+    {
+        m_staleRegion += rect;
+        m_dirtyRegion += rect;
+    }
+
     void LayerGroup::addLayer(std::shared_ptr<Layer> layer)
     {
         m_layers.push_back(layer);
+        markChildDirty(layer->getContentBounds());
     }
 
     void LayerGroup::removeLayer(std::shared_ptr<Layer> layer)
     {
-        m_layers.erase(
-            std::remove(m_layers.begin(), m_layers.end(), layer),
-            m_layers.end()
-        );
+        auto it = std::find(m_layers.begin(), m_layers.end(), layer);
+        if (it == m_layers.end()) return;
+        markChildDirty(layer->getContentBounds());
+        m_layers.erase(it);
     }
 
     void LayerGroup::addGroup(std::shared_ptr<LayerGroup> group)
     {
         m_groups.push_back(group);
+        markChildDirty(group->getContentBounds());
     }
 
     void LayerGroup::removeGroup(std::shared_ptr<LayerGroup> group)
     {
-        m_groups.erase(
-            std::remove(m_groups.begin(), m_groups.end(), group),
-            m_groups.end()
-        );
+        auto it = std::find(m_groups.begin(), m_groups.end(), group);
+        if (it == m_groups.end()) return;
+        markChildDirty(group->getContentBounds());
+        m_groups.erase(it);
     }
 
 } // namespace LibreCanvas
@@ -3,7 +3,11 @@
 #include <QImage>
 #include <QString>
 #include <QPainter>
+#include <QRegion>
+#include <functional>
 #include <memory>
+#include "tiledsurface.h"
+#include "core/blend.h"
 
 namespace LibreCanvas {
 
@@ -24,7 +28,8 @@ namespace LibreCanvas {
 
     class Layer {
     public:
-        Layer(const QString& name, int width, int height);
+        Layer(const QString& name, int width, int height,
+              QImage::Format format = QImage::Format_ARGB32_Premultiplied);
         Layer(const QString& name, const QImage& image);
         ~Layer();
 
@@ -33,24 +38,68 @@ namespace LibreCanvas {
         void setName(const QString& name) { m_name = name; }
 
         bool isVisible() const { return m_visible; }
-        void setVisible(bool visible) { m_visible = visible; }
+        void setVisible(bool visible);
 
         bool isLocked() const { return m_locked; }
         void setLocked(bool locked) { m_locked = locked; }
 
         float getOpacity() const { return m_opacity; }
-        void setOpacity(float opacity) { m_opacity = qBound(0.0f, opacity, 1.0f); }
+        void setOpacity(float opacity);
 
         BlendMode getBlendMode() const { return m_blendMode; }
-        void setBlendMode(BlendMode mode) { m_blendMode = mode; }
-
-        // Image access
-        QImage& getImage() { return m_image; }
-        const QImage& getImage() const { return m_image; }
-
-        QSize getSize() const { return m_image.size(); }
-
-        // Layer mask
+        void setBlendMode(BlendMode mode);
+
+        // Pixel access
+        TiledSurface& getSurface() { return m_surface; }
+        const TiledSurface& getSurface() const { return m_surface; }
+        void paint(const QRect& area, const std::function<void(QPainter&)>& painterFunction);
+        void drawDabs(const std::vector<TiledSurface::Dab>& dabs, const QColor& color, float opacity,
+                      LibreEffects::Core::BlendSpace space);
+        void eraseDabs(const std::vector<TiledSurface::Dab>& dabs, float opacity);
+
+        // Saves each tile before its first write until endCapture(); see
+        // TiledSurface. restoreTiles() puts saved tiles back and marks them dirty.
+        void beginCapture() { m_surface.beginCapture(); }
+        std::vector<TiledSurface::TileState> endCapture() { return m_surface.endCapture(); }
+        void restoreTiles(const std::vector<TiledSurface::TileState>& tiles);
+
+        // Whole-image compatibility path; assembles or re-tiles the full raster
+        QImage getImage() const { return m_surface.toImage(); }
+        void setImage(const QImage& image);
+
+        void convertToFormat(QImage::Format format);
+
+        QSize getSize() const { return m_surface.getSize(); }
+        QRect getBounds() const { return QRect(m_offset, m_surface.getSize()); }
+        // Box around the non-transparent pixels, in document coordinates
+        QRect getContentBounds() const { return m_surface.getContentBounds().translated(m_offset); }
+        // Whether the layer hides everything below it inside area, given in
+        // document coordinates
+        bool occludes(const QRect& area) const;
+
+        // Dirty tracking, in document coordinates
+        void markDirty(const QRect& layerRect);
+        // Transparent pixels look the same under any property, so a layer-wide
+        // change only dirties its content
+        void markAllDirty() { m_dirtyRegion += getContentBounds(); }
+        QRegion takeDirtyRegion();
+        const QRegion& getDirtyRegion() const { return m_dirtyRegion; }
+
+        // Copies made for rendering on another thread share pixels with this
+        // layer and keep its id. takeSnapshot() moves the pending dirty
+        // region onto the copy; assign() updates a copy and adds the
+        // incoming dirty region to the one it still has pending.
+        quint64 getId() const { return m_id; }
+        std::shared_ptr<Layer> takeSnapshot();
+        void assign(const Layer& other);
+
+        // Copy for history: shares tiles and the mask with this layer until
+        // either side writes them, so it only costs memory for what changes
+        // afterwards. Keeps the id; nothing is marked dirty on it.
+        std::shared_ptr<Layer> clone() const;
+
+        // Layer mask: Grayscale8, the size of the layer; 255 shows a pixel
+        // and 0 hides it. It scales layer alpha when compositing.
         bool hasMask() const { return !m_mask.isNull(); }
         QImage& getMask() { return m_mask; }
         const QImage& getMask() const { return m_mask; }
@@ -59,17 +108,20 @@ namespace LibreCanvas {
         void applyMask();
 
         // Rendering
-        void render(QPainter& painter, const QRect& destRect) const;
+        void render(QPainter& painter, const QRect& destRect) const { render(painter, destRect, destRect); }
+        void render(QPainter& painter, const QRect& destRect, const QRect& exposedRect) const;
 
         // Transform
-        void setOffset(const QPoint& offset) { m_offset = offset; }
+        void setOffset(const QPoint& offset);
         QPoint getOffset() const { return m_offset; }
 
     private:
+        quint64 m_id;
         QString m_name;
-        QImage m_image;
+        TiledSurface m_surface;
         QImage m_mask;
         QPoint m_offset;
+        QRegion m_dirtyRegion;
         
         bool m_visible;
         bool m_locked;
@@ -77,8 +129,22 @@ namespace LibreCanvas {
         BlendMode m_blendMode;
 
         void applyBlendMode(QPainter& painter) const;
+        void maskTile(QImage& tile, const QRect& bounds) const;
+    };
+
+    // Children of an isolated group composited on their own, in document
+    // coordinates. Filled in by the compositor; pixels outside valid are stale.
+    struct GroupCache {
+        QImage image;
+        QRect rect;
+        QRegion valid;
+        LibreEffects::Core::BlendSpace space = LibreEffects::Core::BlendSpace::Srgb;
     };
 
+    // Layers and nested groups rendered as one unit; child groups stack
+    // above the group's own layers. An isolated group blends its cached
+    // children with its own opacity and blend mode, a pass-through group at
+    // full opacity blends its children straight onto the backdrop.
     class LayerGroup {
     public:
         LayerGroup(const QString& name);
@@ -88,11 +154,46 @@ namespace LibreCanvas {
         void setName(const QString& name) { m_name = name; }
 
         bool isVisible() const { return m_visible; }
-        void setVisible(bool visible) { m_visible = visible; }
+        void setVisible(bool visible);
 
         bool isExpanded() const { return m_expanded; }
         void setExpanded(bool expanded) { m_expanded = expanded; }
 
+        float getOpacity() const { return m_opacity; }
+        void setOpacity(float opacity);
+
+        BlendMode getBlendMode() const { return m_blendMode; }
+        void setBlendMode(BlendMode mode);
+
+        bool isPassThrough() const { return m_passThrough; }
+        void setPassThrough(bool passThrough);
+
+        // Pass-through needs full opacity; otherwise the group is isolated
+        bool isIsolated() const { return !m_passThrough || m_opacity < 1.0f; }
+
+        // Union of the descendants' content, in document coordinates
+        QRect getContentBounds() const;
+
+        // Collects the dirty regions of all descendants, dropping them from
+        // the cache, plus the group's own property changes, which leave
+        // the cached children intact
+        QRegion takeDirtyRegion();
+        GroupCache& getCache() const { return m_cache; }
+
+        // Render copies, as for Layer. A snapshot holds snapshots of the
+        // children; assign() takes the already mirrored children and keeps
+        // this group's cache.
+        quint64 getId() const { return m_id; }
+        QRegion getPendingRegion() const;
+        std::shared_ptr<LayerGroup> takeSnapshot();
+        void assign(const LayerGroup& other, std::vector<std::shared_ptr<Layer>> layers,
+                    std::vector<std::shared_ptr<LayerGroup>> groups);
+
+        // History copy of the group and its descendants, as for Layer. It
+        // starts without a cache and with its content marked changed, so
+        // render mirrors of a restored group redraw it.
+        std::shared_ptr<LayerGroup> clone() const;
+
         void addLayer(std::shared_ptr<Layer> layer);
         void removeLayer(std::shared_ptr<Layer> layer);
         void addGroup(std::shared_ptr<LayerGroup> group);
@@ -102,11 +203,20 @@ namespace LibreCanvas {
         const std::vector<std::shared_ptr<LayerGroup>>& getGroups() const { return m_groups; }
 
     private:
+        quint64 m_id;
         QString m_name;
         std::vector<std::shared_ptr<Layer>> m_layers;
         std::vector<std::shared_ptr<LayerGroup>> m_groups;
         bool m_visible;
         bool m_expanded;
+        float m_opacity;
+        BlendMode m_blendMode;
+        bool m_passThrough;
+        QRegion m_dirtyRegion;
+        QRegion m_staleRegion;
+        mutable GroupCache m_cache;
+
+        void markChildDirty(const QRect& rect);
     };
 
 } // namespace LibreCanvas
@@ -81,7 +81,9 @@ void LayerPanel::setupUI()
     m_layerNameEdit = new QLineEdit(this);
     connect(m_layerNameEdit, &QLineEdit::editingFinished, this, [this]() {
         if (m_activeLayer) {
+            const auto before = LibreCanvas::LayerProperties::of(*m_activeLayer);
             m_activeLayer->setName(m_layerNameEdit->text());
+            recordLayerChange(m_activeLayer, before, "Rename Layer");
             if (m_activeItem) {
                 m_activeItem->setText(0, m_layerNameEdit->text());
             }
@@ -246,7 +248,9 @@ void LayerPanel::onLayerItemChanged(QTreeWidgetItem *item, int column)
         auto layer = item->data(1, Qt::UserRole).value<std::shared_ptr<LibreCanvas::Layer>>();
         if (layer) {
             bool visible = item->checkState(0) == Qt::Checked;
+            const auto before = LibreCanvas::LayerProperties::of(*layer);
             layer->setVisible(visible);
+            recordLayerChange(layer, before, "Layer Visibility");
             emit layerVisibilityChanged(layer, visible);
         }
     }
@@ -261,7 +265,8 @@ void LayerPanel::onNewLayerClicked()
                                          QLineEdit::Normal, "Layer " + QString::number(m_document->getLayerCount() + 1), &ok);
     if (!ok || name.isEmpty()) return;
     
-    auto layer = std::make_shared<LibreCanvas::Layer>(name, m_document->getSize().width(), m_document->getSize().height());
+    auto layer = std::make_shared<LibreCanvas::Layer>(name, m_document->getSize().width(), m_document->getSize().height(),
+                                                      m_document->getImageFormat());
     m_document->addLayer(layer);
     updateLayerList();
     setActiveLayer(layer);
@@ -319,7 +324,9 @@ void LayerPanel::onOpacitySliderChanged(int value)
 {
     if (m_activeLayer) {
         float opacity = value / 100.0f;
+        const auto before = LibreCanvas::LayerProperties::of(*m_activeLayer);
         m_activeLayer->setOpacity(opacity);
+        recordLayerChange(m_activeLayer, before, "Layer Opacity");
         emit layerOpacityChanged(m_activeLayer, opacity);
     }
 }
@@ -328,8 +335,19 @@ void LayerPanel::onBlendModeChanged(int index)
 {
     if (m_activeLayer) {
         LibreCanvas::BlendMode mode = static_cast<LibreCanvas::BlendMode>(index);
+        const auto before = LibreCanvas::LayerProperties::of(*m_activeLayer);
         m_activeLayer->setBlendMode(mode);
+        recordLayerChange(m_activeLayer, before, "Layer Blend Mode");
         emit layerBlendModeChanged(m_activeLayer, mode);
     }
 }
 
+void LayerPanel::recordLayerChange(const std::shared_ptr<LibreCanvas::Layer> &layer,
+                                   const LibreCanvas::LayerProperties &before, const QString &description)
+{
+    const auto after = LibreCanvas::LayerProperties::of(*layer);
+    if (m_document && after != before) {
+        m_document->recordCommand(std::make_shared<LibreCanvas::LayerPropertyCommand>(layer->getId(), before, after),
+                                  description);
+    }
+}
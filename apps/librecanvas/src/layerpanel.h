@@ -13,6 +13,7 @@
 #include <memory>
 #include "document.h"
 #include "layer.h"
+#include "history.h"
 
 class LayerPanel : public QWidget
 {
@@ -50,6 +51,9 @@ private:
     QTreeWidgetItem* createLayerItem(std::shared_ptr<LibreCanvas::Layer> layer);
     QTreeWidgetItem* createGroupItem(std::shared_ptr<LibreCanvas::LayerGroup> group);
     void populateLayers();
+    // Puts a property edit on the undo stack as a command, if anything changed
+    void recordLayerChange(const std::shared_ptr<LibreCanvas::Layer> &layer,
+                           const LibreCanvas::LayerProperties &before, const QString &description);
 
     QTreeWidget *m_layerTree;
     QPushButton *m_newLayerBtn;
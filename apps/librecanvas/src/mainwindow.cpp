@@ -17,6 +17,7 @@
 #include <QWidget>
 #include <QFileInfo>
 #include <QDockWidget>
+#include <QSignalBlocker>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -38,6 +39,7 @@ MainWindow::MainWindow(QWidget *parent)
     // Connect canvas signals
     connect(m_canvasWidget, &CanvasWidget::imageChanged, this, &MainWindow::updateStatusBar);
     connect(m_canvasWidget, &CanvasWidget::zoomChanged, this, &MainWindow::updateStatusBar);
+    connect(m_canvasWidget, &CanvasWidget::frameStatsUpdated, this, &MainWindow::updateFrameStats);
     
     createMenus();
     createToolBars();
@@ -48,8 +50,12 @@ MainWindow::MainWindow(QWidget *parent)
     
     // Connect canvas document changes to layer panel
     connect(m_canvasWidget, &CanvasWidget::documentChanged, this, [this]() {
-        if (m_canvasWidget->getDocument()) {
-            m_layerPanel->setDocument(m_canvasWidget->getDocument());
+        // The blend space belongs to the document; show the new one's
+        auto doc = m_canvasWidget->getDocument();
+        QSignalBlocker blocker(m_linearBlendAction);
+        m_linearBlendAction->setChecked(doc && doc->getBlendSpace() == LibreEffects::Core::BlendSpace::Linear);
+        if (doc) {
+            m_layerPanel->setDocument(doc);
         }
     });
     
@@ -61,13 +67,13 @@ MainWindow::MainWindow(QWidget *parent)
         }
     });
     connect(m_layerPanel, &LayerPanel::layerVisibilityChanged, this, [this](auto, bool) {
-        m_canvasWidget->update();
+        m_canvasWidget->refresh();
     });
     connect(m_layerPanel, &LayerPanel::layerOpacityChanged, this, [this](auto, float) {
-        m_canvasWidget->update();
+        m_canvasWidget->refresh();
     });
     connect(m_layerPanel, &LayerPanel::layerBlendModeChanged, this, [this](auto, auto) {
-        m_canvasWidget->update();
+        m_canvasWidget->refresh();
     });
 }
 
@@ -110,7 +116,17 @@ void MainWindow::createMenus()
     
     // Edit Menu
     m_editMenu = menuBar()->addMenu("&Edit");
-    // Edit actions will be added here
+    
+    m_linearBlendAction = new QAction("Blend in &Linear Light", this);
+    m_linearBlendAction->setCheckable(true);
+    m_linearBlendAction->setStatusTip("Composite and paint this document in linear light instead of sRGB");
+    connect(m_linearBlendAction, &QAction::toggled, this, [this](bool checked) {
+        auto doc = m_canvasWidget->getDocument();
+        if (!doc) return;
+        doc->setBlendSpace(checked ? LibreEffects::Core::BlendSpace::Linear : LibreEffects::Core::BlendSpace::Srgb);
+        m_canvasWidget->refresh();
+    });
+    m_editMenu->addAction(m_linearBlendAction);
     
     // View Menu
     m_viewMenu = menuBar()->addMenu("&View");
@@ -141,6 +157,16 @@ void MainWindow::createMenus()
     connect(fitToWindowAction, &QAction::triggered, this, &MainWindow::fitToWindow);
     m_viewMenu->addAction(fitToWindowAction);
     
+    m_viewMenu->addSeparator();
+    
+    QAction *frameStatsAction = new QAction("Frame &Statistics", this);
+    frameStatsAction->setCheckable(true);
+    frameStatsAction->setStatusTip("Show canvas frame rate, input latency and dropped frames");
+    connect(frameStatsAction, &QAction::toggled, this, [this](bool checked) {
+        m_frameLabel->setVisible(checked);
+    });
+    m_viewMenu->addAction(frameStatsAction);
+    
     // Help Menu
     m_helpMenu = menuBar()->addMenu("&Help");
     
@@ -171,6 +197,10 @@ void MainWindow::createStatusBar()
     m_sizeLabel = new QLabel("Size: -");
     statusBar()->addPermanentWidget(m_sizeLabel);
     
+    m_frameLabel = new QLabel("Frames: -");
+    m_frameLabel->setVisible(false);
+    statusBar()->addPermanentWidget(m_frameLabel);
+    
     statusBar()->showMessage("Welcome to LibreCanvas", 3000);
 }
 
@@ -599,11 +629,22 @@ void MainWindow::newFile()
     int height = QInputDialog::getInt(this, "New Image", "Height:", 1080, 1, 10000, 1, &ok);
     if (!ok) return;
     
-    m_canvasWidget->newImage(width, height);
+    const QList<LibreCanvas::PixelDepth> depths = {
+        LibreCanvas::PixelDepth::Uint8, LibreCanvas::PixelDepth::Uint16, LibreCanvas::PixelDepth::Float32
+    };
+    QStringList depthNames;
+    for (LibreCanvas::PixelDepth depth : depths) {
+        depthNames << LibreCanvas::pixelDepthName(depth);
+    }
+    QString depthName = QInputDialog::getItem(this, "New Image", "Bit depth:", depthNames, 0, false, &ok);
+    if (!ok) return;
+    LibreCanvas::PixelDepth depth = depths[depthNames.indexOf(depthName)];
+    
+    m_canvasWidget->newImage(width, height, depth);
     if (m_canvasWidget->getDocument()) {
         m_layerPanel->setDocument(m_canvasWidget->getDocument());
     }
-    m_statusLabel->setText(QString("New image created: %1x%2").arg(width).arg(height));
+    m_statusLabel->setText(QString("New image created: %1x%2, %3").arg(width).arg(height).arg(depthName));
     updateStatusBar();
 }
 
@@ -663,14 +704,9 @@ void MainWindow::fitToWindow()
 void MainWindow::updateStatusBar()
 {
     if (m_canvasWidget->hasImage()) {
-        QImage img = m_canvasWidget->getImage();
         auto doc = m_canvasWidget->getDocument();
-        if (doc) {
-            int layerCount = doc->getLayerCount();
-            m_sizeLabel->setText(QString("Size: %1x%2 | Layers: %3").arg(img.width()).arg(img.height()).arg(layerCount));
-        } else {
-            m_sizeLabel->setText(QString("Size: %1x%2").arg(img.width()).arg(img.height()));
-        }
+        QSize size = doc->getSize();
+        m_sizeLabel->setText(QString("Size: %1x%2 | Layers: %3").arg(size.width()).arg(size.height()).arg(doc->getLayerCount()));
         m_zoomLabel->setText(QString("Zoom: %1%").arg(static_cast<int>(m_canvasWidget->getZoomLevel() * 100)));
     } else {
         m_sizeLabel->setText("Size: -");
@@ -678,6 +714,16 @@ void MainWindow::updateStatusBar()
     }
 }
 
+void MainWindow::updateFrameStats(const FrameStats &stats)
+{
+    m_frameLabel->setText(QString("%1 fps @ %2 Hz | Latency: %3 ms avg, %4 ms max | Dropped: %5")
+        .arg(stats.frames)
+        .arg(qRound(stats.refreshRate))
+        .arg(stats.averageLatencyMs, 0, 'f', 1)
+        .arg(stats.maxLatencyMs, 0, 'f', 1)
+        .arg(stats.droppedFrames));
+}
+
 void MainWindow::about()
 {
     QMessageBox::about(this, "About LibreCanvas",
@@ -32,6 +32,7 @@ private slots:
     void resetZoom();
     void fitToWindow();
     void updateStatusBar();
+    void updateFrameStats(const FrameStats &stats);
     void about();
 
 private:
@@ -46,6 +47,7 @@ private:
     QAction *m_saveAction;
     QAction *m_exitAction;
     QAction *m_aboutAction;
+    QAction *m_linearBlendAction;
     
     // View actions
     QAction *m_zoomInAction;
@@ -66,6 +68,7 @@ private:
     QLabel *m_statusLabel;
     QLabel *m_zoomLabel;
     QLabel *m_sizeLabel;
+    QLabel *m_frameLabel;
     
     // Canvas widget
     CanvasWidget *m_canvasWidget;
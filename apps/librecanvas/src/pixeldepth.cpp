@@ -0,0 +1,44 @@
+#include "pixeldepth.h"
+
+namespace LibreCanvas {
+
+    QImage::Format imageFormat(PixelDepth depth)
+    {
+        switch (depth) {
+            case PixelDepth::Uint8: return QImage::Format_ARGB32_Premultiplied;
+            case PixelDepth::Uint16: return QImage::Format_RGBA64_Premultiplied;
+            case PixelDepth::Float32: return QImage::Format_RGBA32FPx4_Premultiplied;
+        }
+        return QImage::Format_ARGB32_Premultiplied;
+    }
+
+    QImage::Format exportFormat(PixelDepth depth)
+    {
+        switch (depth) {
+            case PixelDepth::Uint8: return QImage::Format_ARGB32;
+            case PixelDepth::Uint16: return QImage::Format_RGBA64;
+            case PixelDepth::Float32: return QImage::Format_RGBA32FPx4;
+        }
+        return QImage::Format_ARGB32;
+    }
+
+    LibreEffects::Core::PixelFormat corePixelFormat(QImage::Format format)
+    {
+        switch (format) {
+            case QImage::Format_RGBA64_Premultiplied: return LibreEffects::Core::PixelFormat::RGBA64;
+            case QImage::Format_RGBA32FPx4_Premultiplied: return LibreEffects::Core::PixelFormat::RGBA32F;
+            default: return LibreEffects::Core::PixelFormat::ARGB32;
+        }
+    }
+
+    QString pixelDepthName(PixelDepth depth)
+    {
+        switch (depth) {
+            case PixelDepth::Uint8: return "8-bit";
+            case PixelDepth::Uint16: return "16-bit";
+            case PixelDepth::Float32: return "32-bit float";
+        }
+        return QString();
+    }
+
+} // namespace LibreCanvas
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QImage>
+#include <QString>
+#include "core/blend.h"
+
+namespace LibreCanvas {
+
+    // Per-channel precision a document keeps its layers, projection and
+    // history in. 8-bit is the default and fastest; the wider depths avoid
+    // banding in gradients and heavy retouching.
+    enum class PixelDepth {
+        Uint8,
+        Uint16,
+        Float32
+    };
+
+    // Premultiplied format used for layers and the projection
+    QImage::Format imageFormat(PixelDepth depth);
+
+    // Straight-alpha format handed to image writers on export
+    QImage::Format exportFormat(PixelDepth depth);
+
+    // Core kernel layout for one of the internal formats above
+    LibreEffects::Core::PixelFormat corePixelFormat(QImage::Format format);
+
+    QString pixelDepthName(PixelDepth depth);
+
+} // namespace LibreCanvas
@@ -0,0 +1,262 @@
+#include "renderworker.h"
+#include <QMutexLocker>
+#include <cmath>
+
+namespace LibreCanvas {
+
+    // Scaled pieces are cut on this grid, in image pixels, so refinement
+    // can stop between pieces when a newer request arrives
+    static constexpr int ChunkSize = 512;
+
+    static std::vector<QRect> splitIntoChunks(const QRegion& region)
+    {
+        std::vector<QRect> chunks;
+        for (const QRect& rect : region) {
+            for (int y = rect.top() / ChunkSize * ChunkSize; y <= rect.bottom(); y += ChunkSize) {
+                for (int x = rect.left() / ChunkSize * ChunkSize; x <= rect.right(); x += ChunkSize) {
+                    chunks.push_back(rect.intersected(QRect(x, y, ChunkSize, ChunkSize)));
+                }
+            }
+        }
+        return chunks;
+    }
+
+    RenderWorker::RenderWorker(QObject* parent)
+        : QObject(parent)
+        , m_scheduled(false)
+        , m_documentSerial(0)
+        , m_zoom(1.0f)
+    {
+    }
+
+    void RenderWorker::submit(RenderRequest request)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_pending.push_back(std::move(request));
+        if (!m_scheduled) {
+            m_scheduled = true;
+            QMetaObject::invokeMethod(this, &RenderWorker::process, Qt::QueuedConnection);
+        }
+    }
+
+    bool RenderWorker::hasPending()
+    {
+        QMutexLocker locker(&m_mutex);
+        return !m_pending.empty();
+    }
+
+    void RenderWorker::process()
+    {
+        std::vector<RenderRequest> batch;
+        {
+            QMutexLocker locker(&m_mutex);
+            batch.swap(m_pending);
+            m_scheduled = false;
+        }
+        if (batch.empty()) return;
+
+        // Every snapshot is adopted so no dirty region is lost; only the
+        // latest view is drawn
+        bool fullView = false;
+        qint64 inputTime = -1;
+        for (const RenderRequest& request : batch) {
+            if (request.documentSerial != m_documentSerial) {
+                // A different document; nothing kept for the last one applies
+                m_documentSerial = request.documentSerial;
+                m_replica.reset();
+                m_layerMirrors.clear();
+                m_groupMirrors.clear();
+                fullView = true;
+            }
+            adopt(request.snapshot);
+            fullView = fullView || request.fullView;
+            if (request.inputTime >= 0 && (inputTime < 0 || request.inputTime < inputTime)) {
+                inputTime = request.inputTime;
+            }
+        }
+
+        const RenderRequest& latest = batch.back();
+        if (latest.zoom != m_zoom || latest.viewRect != m_viewRect) {
+            m_zoom = latest.zoom;
+            m_viewRect = latest.viewRect;
+            m_unrefined = QRegion();
+            fullView = true;
+        }
+
+        // Fast pass: everything that changed, in one delivery
+        RenderResult preview;
+        preview.documentSerial = m_documentSerial;
+        preview.zoom = m_zoom;
+        preview.viewRect = m_viewRect;
+        preview.requestSerial = latest.requestSerial;
+        preview.inputTime = inputTime;
+        if (m_viewRect.isEmpty()) {
+            emit tilesReady(preview);
+            return;
+        }
+
+        const QRect imageRect = zoomedToImageRect(m_viewRect);
+        QRegion area = m_replica->updateProjection(imageRect);
+        if (fullView) {
+            area = imageRect;
+        }
+
+        const int level = Document::mipLevelForZoom(m_zoom);
+        const bool exact = m_zoom * (1 << level) == 1.0f;
+
+        preview.refined = exact;
+        for (const QRect& chunk : splitIntoChunks(area)) {
+            preview.tiles.push_back(renderTile(chunk, false));
+        }
+        emit tilesReady(preview);
+        if (!exact) {
+            m_unrefined += area;
+        }
+
+        // Smooth pass, piece by piece, given up as soon as input moves on;
+        // what is left is picked up after the next request
+        for (const QRect& chunk : splitIntoChunks(m_unrefined)) {
+            if (hasPending()) return;
+
+            RenderResult refined;
+            refined.documentSerial = m_documentSerial;
+            refined.zoom = m_zoom;
+            refined.viewRect = m_viewRect;
+            refined.refined = true;
+            refined.tiles.push_back(renderTile(chunk, true));
+            emit tilesReady(refined);
+            m_unrefined -= chunk;
+        }
+    }
+
+    void RenderWorker::adopt(const RenderSnapshot& snapshot)
+    {
+        if (!m_replica || m_replica->getSize() != snapshot.size || m_replica->getPixelDepth() != snapshot.depth) {
+            m_replica = std::make_shared<Document>(snapshot.size.width(), snapshot.size.height(),
+                                                   snapshot.background, snapshot.depth);
+            m_layerMirrors.clear();
+            m_groupMirrors.clear();
+        } else if (m_replica->getBackgroundColor() != snapshot.background) {
+            m_replica->setBackgroundColor(snapshot.background);
+        }
+        m_replica->setBlendSpace(snapshot.blendSpace);
+
+        // Mirrors keep their identity across snapshots so the replica's
+        // caches survive; ones no longer in the stack are released
+        std::map<quint64, std::shared_ptr<Layer>> layers;
+        std::map<quint64, std::shared_ptr<LayerGroup>> groups;
+        std::vector<std::shared_ptr<Layer>> layerStack;
+        std::vector<std::shared_ptr<LayerGroup>> groupStack;
+        for (const auto& layer : snapshot.layers) {
+            layerStack.push_back(mirrorLayer(layer, layers));
+        }
+        for (const auto& group : snapshot.groups) {
+            groupStack.push_back(mirrorGroup(group, layers, groups));
+        }
+        m_layerMirrors.swap(layers);
+        m_groupMirrors.swap(groups);
+
+        m_replica->setStack(layerStack, groupStack, snapshot.activeIndex);
+        m_replica->markDirty(snapshot.dirty);
+    }
+
+    std::shared_ptr<Layer> RenderWorker::mirrorLayer(const std::shared_ptr<Layer>& snapshot,
+                                                     std::map<quint64, std::shared_ptr<Layer>>& layers)
+    {
+        std::shared_ptr<Layer> mirror = snapshot;
+        auto it = m_layerMirrors.find(snapshot->getId());
+        if (it != m_layerMirrors.end()) {
+            mirror = it->second;
+            mirror->assign(*snapshot);
+        }
+        layers[snapshot->getId()] = mirror;
+        return mirror;
+    }
+
+    std::shared_ptr<LayerGroup> RenderWorker::mirrorGroup(const std::shared_ptr<LayerGroup>& snapshot,
+                                                          std::map<quint64, std::shared_ptr<Layer>>& layers,
+                                                          std::map<quint64, std::shared_ptr<LayerGroup>>& groups)
+    {
+        std::vector<std::shared_ptr<Layer>> childLayers;
+        std::vector<std::shared_ptr<LayerGroup>> childGroups;
+        for (const auto& layer : snapshot->getLayers()) {
+            childLayers.push_back(mirrorLayer(layer, layers));
+        }
+        for (const auto& group : snapshot->getGroups()) {
+            childGroups.push_back(mirrorGroup(group, layers, groups));
+        }
+
+        std::shared_ptr<LayerGroup> mirror;
+        auto it = m_groupMirrors.find(snapshot->getId());
+        if (it != m_groupMirrors.end()) {
+            mirror = it->second;
+        } else {
+            mirror = std::make_shared<LayerGroup>(snapshot->getName());
+        }
+        mirror->assign(*snapshot, std::move(childLayers), std::move(childGroups));
+        groups[snapshot->getId()] = mirror;
+        return mirror;
+    }
+
+    RenderTile RenderWorker::renderTile(const QRect& imageRect, bool smooth) const
+    {
+        // Zoomed out, scale down from the nearest mip level instead of the full projection
+        const int level = Document::mipLevelForZoom(m_zoom);
+        const QImage& source = m_replica->getMipLevel(level);
+        const float scale = m_zoom * (1 << level);
+
+        QRect levelRect(QPoint(imageRect.left() >> level, imageRect.top() >> level),
+                        QPoint(imageRect.right() >> level, imageRect.bottom() >> level));
+        RenderTile tile;
+        if (scale == 1.0f) {
+            tile.rect = levelRect;
+            tile.image = source.copy(levelRect);
+        } else {
+            // Pad the source so filtered edges blend with the untouched
+            // neighbours, on each side where those are composited already
+            const QRegion& pending = m_replica->getPendingRegion();
+            auto composited = [&](const QRect& strip) {
+                const QRect clipped = strip.intersected(source.rect());
+                if (clipped.isEmpty()) return true;
+                const QRect imageStrip(QPoint(clipped.left() << level, clipped.top() << level),
+                                       QPoint(((clipped.right() + 1) << level) - 1, ((clipped.bottom() + 1) << level) - 1));
+                return !pending.intersects(imageStrip);
+            };
+            const int pad = 2;
+            const QRect outer = levelRect.adjusted(-pad, -pad, pad, pad);
+            const int left = composited(QRect(outer.left(), outer.top(), pad, outer.height())) ? pad : 0;
+            const int top = composited(QRect(outer.left(), outer.top(), outer.width(), pad)) ? pad : 0;
+            const int right = composited(QRect(levelRect.right() + 1, outer.top(), pad, outer.height())) ? pad : 0;
+            const int bottom = composited(QRect(outer.left(), levelRect.bottom() + 1, outer.width(), pad)) ? pad : 0;
+            QRect padded = levelRect.adjusted(-left, -top, right, bottom).intersected(source.rect());
+            tile.rect = levelRectToZoomed(padded, scale);
+            tile.image = source.copy(padded).scaled(tile.rect.size(), Qt::IgnoreAspectRatio,
+                                                    smooth ? Qt::SmoothTransformation : Qt::FastTransformation);
+        }
+
+        // The canvas pixmap is 8-bit; convert here rather than on the GUI thread
+        if (tile.image.format() != QImage::Format_ARGB32_Premultiplied) {
+            tile.image = tile.image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        }
+        return tile;
+    }
+
+    QRect RenderWorker::levelRectToZoomed(const QRect& rect, float scale)
+    {
+        int left = static_cast<int>(std::floor(rect.left() * scale));
+        int top = static_cast<int>(std::floor(rect.top() * scale));
+        int right = static_cast<int>(std::ceil((rect.right() + 1) * scale));
+        int bottom = static_cast<int>(std::ceil((rect.bottom() + 1) * scale));
+        return QRect(left, top, right - left, bottom - top);
+    }
+
+    QRect RenderWorker::zoomedToImageRect(const QRect& rect) const
+    {
+        int left = static_cast<int>(std::floor(rect.left() / m_zoom));
+        int top = static_cast<int>(std::floor(rect.top() / m_zoom));
+        int right = static_cast<int>(std::ceil((rect.right() + 1) / m_zoom));
+        int bottom = static_cast<int>(std::ceil((rect.bottom() + 1) / m_zoom));
+        return QRect(left, top, right - left, bottom - top).intersected(QRect(QPoint(0, 0), m_replica->getSize()));
+    }
+
+} // namespace LibreCanvas
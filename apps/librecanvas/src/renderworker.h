@@ -0,0 +1,102 @@
+#pragma once
+
+#include <QObject>
+#include <QImage>
+#include <QMutex>
+#include <QRegion>
+#include <QMetaType>
+#include <map>
+#include <memory>
+#include <vector>
+#include "document.h"
+
+namespace LibreCanvas {
+
+    // What the canvas needs drawn: the document state at the time of the
+    // request and the part of the zoomed image the widget keeps
+    struct RenderRequest {
+        RenderSnapshot snapshot;
+        float zoom = 1.0f;
+        QRect viewRect;
+        // The view moved or zoomed; everything in viewRect is redrawn
+        bool fullView = false;
+        // Changes when the canvas switches documents
+        quint64 documentSerial = 0;
+        // Counts up with every request; echoed back so the canvas knows
+        // which requests are still in flight
+        quint64 requestSerial = 0;
+        // When the oldest input folded into this request arrived, on the
+        // canvas frame clock, or -1 when no input is behind it
+        qint64 inputTime = -1;
+    };
+
+    // A piece of the zoomed image, ready to be drawn into the canvas pixmap
+    struct RenderTile {
+        QRect rect;
+        QImage image;
+    };
+
+    struct RenderResult {
+        quint64 documentSerial = 0;
+        float zoom = 1.0f;
+        QRect viewRect;
+        bool refined = false;
+        std::vector<RenderTile> tiles;
+        // Set on the first delivery for a batch of requests: the latest
+        // request handled and the oldest input time among them
+        quint64 requestSerial = 0;
+        qint64 inputTime = -1;
+    };
+
+    // Composites and scales the canvas on its own thread. It keeps a replica
+    // of the document whose layers mirror the snapshots it receives, so the
+    // projection, mips and compositor caches persist between requests.
+    // Requests that pile up while it is busy are merged and only the latest
+    // view is drawn. Each change is first delivered with fast scaling, then
+    // redrawn with smooth scaling once no newer request is waiting. Every
+    // batch gets a first delivery, even an empty one, so the canvas can tell
+    // when its requests are done.
+    class RenderWorker : public QObject {
+        Q_OBJECT
+
+    public:
+        explicit RenderWorker(QObject* parent = nullptr);
+
+        // Thread-safe; returns immediately
+        void submit(RenderRequest request);
+
+    signals:
+        void tilesReady(const LibreCanvas::RenderResult& result);
+
+    private:
+        void process();
+        bool hasPending();
+        void adopt(const RenderSnapshot& snapshot);
+        std::shared_ptr<Layer> mirrorLayer(const std::shared_ptr<Layer>& snapshot,
+                                           std::map<quint64, std::shared_ptr<Layer>>& layers);
+        std::shared_ptr<LayerGroup> mirrorGroup(const std::shared_ptr<LayerGroup>& snapshot,
+                                                std::map<quint64, std::shared_ptr<Layer>>& layers,
+                                                std::map<quint64, std::shared_ptr<LayerGroup>>& groups);
+        RenderTile renderTile(const QRect& imageRect, bool smooth) const;
+
+        static QRect levelRectToZoomed(const QRect& rect, float scale);
+        QRect zoomedToImageRect(const QRect& rect) const;
+
+        QMutex m_mutex;
+        std::vector<RenderRequest> m_pending;
+        bool m_scheduled;
+
+        // Only touched on the worker thread
+        std::shared_ptr<Document> m_replica;
+        std::map<quint64, std::shared_ptr<Layer>> m_layerMirrors;
+        std::map<quint64, std::shared_ptr<LayerGroup>> m_groupMirrors;
+        quint64 m_documentSerial;
+        float m_zoom;
+        QRect m_viewRect;
+        // Image areas delivered with fast scaling only
+        QRegion m_unrefined;
+    };
+
+} // namespace LibreCanvas
+
+Q_DECLARE_METATYPE(LibreCanvas::RenderResult)
@@ -0,0 +1,38 @@
+#include "strokespacer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace LibreCanvas {
+
+    qreal StrokeSpacer::spacingFor(int diameter, float spacing)
+    {
+        return std::max(MinSpacing, static_cast<qreal>(diameter) * spacing);
+    }
+
+    void StrokeSpacer::begin(const QPointF& position)
+    {
+        m_position = position;
+        m_travelled = 0.0;
+    }
+
+    std::vector<QPointF> StrokeSpacer::moveTo(const QPointF& position, qreal spacing)
+    {
+        spacing = std::max(spacing, MinSpacing);
+        const QPointF delta = position - m_position;
+        const qreal length = std::hypot(delta.x(), delta.y());
+
+        std::vector<QPointF> dabs;
+        // Nothing to place along an event that did not move
+        if (length <= 0.0) return dabs;
+        // Spacing may have shrunk since the last dab; catch up right away
+        qreal next = std::max<qreal>(0.0, spacing - m_travelled);
+        while (next <= length) {
+            dabs.push_back(m_position + delta * (next / length));
+            next += spacing;
+        }
+        m_travelled = length - (next - spacing);
+        m_position = position;
+        return dabs;
+    }
+
+} // namespace LibreCanvas
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QPointF>
+#include <vector>
+
+namespace LibreCanvas {
+
+    // Places dabs along a stroke a fixed distance apart. The distance
+    // travelled since the last dab carries over between input events, so
+    // the result does not depend on how fast the pointer moves or how often
+    // events arrive.
+    class StrokeSpacer {
+    public:
+        // Dabs are never closer than this, in pixels, however small the brush
+        static constexpr qreal MinSpacing = 1.0;
+
+        // Distance between dabs for a brush diameter and a spacing given as
+        // a fraction of it
+        static qreal spacingFor(int diameter, float spacing);
+
+        // Starts a stroke; the caller stamps the first dab at position
+        void begin(const QPointF& position);
+        // Dab centres on the way from the last position to position
+        std::vector<QPointF> moveTo(const QPointF& position, qreal spacing);
+
+        QPointF getPosition() const { return m_position; }
+
+    private:
+        QPointF m_position;
+        qreal m_travelled = 0.0;
+    };
+
+} // namespace LibreCanvas
@@ -0,0 +1,477 @@
+#include "tiledsurface.h"
+#include "pixeldepth.h"
+#include <QPainter>
+#include <algorithm>
+
+namespace LibreCanvas {
+
+    namespace {
+
+        struct Argb32Alpha {
+            static bool isTransparent(const uchar* row, int x)
+            {
+                return (reinterpret_cast<const quint32*>(row)[x] >> 24) == 0;
+            }
+            static bool isOpaque(const uchar* row, int x)
+            {
+                return (reinterpret_cast<const quint32*>(row)[x] >> 24) == 0xff;
+            }
+        };
+
+        struct Rgba64Alpha {
+            static bool isTransparent(const uchar* row, int x)
+            {
+                return reinterpret_cast<const quint16*>(row)[x * 4 + 3] == 0;
+            }
+            static bool isOpaque(const uchar* row, int x)
+            {
+                return reinterpret_cast<const quint16*>(row)[x * 4 + 3] == 0xffff;
+            }
+        };
+
+        struct RgbaF32Alpha {
+            static bool isTransparent(const uchar* row, int x)
+            {
+                return reinterpret_cast<const float*>(row)[x * 4 + 3] <= 0.0f;
+            }
+            static bool isOpaque(const uchar* row, int x)
+            {
+                return reinterpret_cast<const float*>(row)[x * 4 + 3] >= 1.0f;
+            }
+        };
+
+        // Formats without an alpha channel
+        struct NoAlpha {
+            static bool isTransparent(const uchar*, int) { return false; }
+            static bool isOpaque(const uchar*, int) { return true; }
+        };
+
+        // Box around the pixels with non-zero alpha inside area, in tile coordinates
+        template <typename Alpha>
+        QRect scanBounds(const QImage& tile, const QRect& area)
+        {
+            int left = area.right() + 1;
+            int right = area.left() - 1;
+            int top = -1;
+            int bottom = -1;
+            for (int y = area.top(); y <= area.bottom(); ++y) {
+                const uchar* row = tile.constScanLine(y);
+                int first = area.left();
+                while (first <= area.right() && Alpha::isTransparent(row, first)) ++first;
+                if (first > area.right()) continue;
+
+                int last = area.right();
+                while (last > first && Alpha::isTransparent(row, last)) --last;
+
+                left = qMin(left, first);
+                right = qMax(right, last);
+                if (top < 0) top = y;
+                bottom = y;
+            }
+            if (top < 0) return QRect();
+            return QRect(QPoint(left, top), QPoint(right, bottom));
+        }
+
+        // Whether every pixel inside area has full alpha, in tile coordinates
+        template <typename Alpha>
+        bool scanOpaque(const QImage& tile, const QRect& area)
+        {
+            for (int y = area.top(); y <= area.bottom(); ++y) {
+                const uchar* row = tile.constScanLine(y);
+                for (int x = area.left(); x <= area.right(); ++x) {
+                    if (!Alpha::isOpaque(row, x)) return false;
+                }
+            }
+            return true;
+        }
+
+        struct AlphaScanner {
+            QRect (*bounds)(const QImage& tile, const QRect& area);
+            bool (*opaque)(const QImage& tile, const QRect& area);
+        };
+
+        template <typename Alpha>
+        AlphaScanner makeAlphaScanner()
+        {
+            return { scanBounds<Alpha>, scanOpaque<Alpha> };
+        }
+
+        AlphaScanner alphaScanner(QImage::Format format)
+        {
+            switch (format) {
+                case QImage::Format_RGBA64:
+                case QImage::Format_RGBA64_Premultiplied:
+                    return makeAlphaScanner<Rgba64Alpha>();
+                case QImage::Format_RGBA32FPx4:
+                case QImage::Format_RGBA32FPx4_Premultiplied:
+                    return makeAlphaScanner<RgbaF32Alpha>();
+                case QImage::Format_ARGB32:
+                case QImage::Format_ARGB32_Premultiplied:
+                    return makeAlphaScanner<Argb32Alpha>();
+                default:
+                    return makeAlphaScanner<NoAlpha>();
+            }
+        }
+
+    } // namespace
+
+    TiledSurface::TiledSurface()
+        : m_format(QImage::Format_ARGB32_Premultiplied)
+        , m_columns(0)
+        , m_rows(0)
+    {
+    }
+
+    TiledSurface::TiledSurface(int width, int height, QImage::Format format)
+        : m_size(qMax(0, width), qMax(0, height))
+        , m_format(format)
+        , m_columns((m_size.width() + TileSize - 1) / TileSize)
+        , m_rows((m_size.height() + TileSize - 1) / TileSize)
+        , m_tiles(static_cast<size_t>(m_columns) * m_rows)
+        , m_tileBounds(m_tiles.size())
+        , m_tileOpaque(m_tiles.size(), false)
+    {
+    }
+
+    TiledSurface::TiledSurface(const QImage& image)
+        : TiledSurface(image.width(), image.height(), image.format())
+    {
+        setImage(image);
+    }
+
+    QRect TiledSurface::tileRect(int column, int row) const
+    {
+        return QRect(column * TileSize, row * TileSize, TileSize, TileSize).intersected(rect());
+    }
+
+    QImage& TiledSurface::tileForWrite(int column, int row)
+    {
+        captureTile(column, row);
+        QImage& tile = m_tiles[tileIndex(column, row)];
+        if (tile.isNull()) {
+            tile = createTile(column, row);
+        }
+        return tile;
+    }
+
+    void TiledSurface::dropTile(int column, int row)
+    {
+        captureTile(column, row);
+        m_tiles[tileIndex(column, row)] = QImage();
+        m_tileBounds[tileIndex(column, row)] = QRect();
+        m_tileOpaque[tileIndex(column, row)] = false;
+        uniteContentBounds();
+    }
+
+    TiledSurface::TileState TiledSurface::saveTile(int column, int row) const
+    {
+        const int index = tileIndex(column, row);
+        return { column, row, m_tiles[index], m_tileBounds[index], m_tileOpaque[index] };
+    }
+
+    void TiledSurface::restoreTiles(const std::vector<TileState>& tiles)
+    {
+        for (const TileState& state : tiles) {
+            const int index = tileIndex(state.column, state.row);
+            m_tiles[index] = state.image;
+            m_tileBounds[index] = state.bounds;
+            m_tileOpaque[index] = state.opaque;
+        }
+        uniteContentBounds();
+    }
+
+    void TiledSurface::beginCapture()
+    {
+        m_capture = std::make_shared<Capture>();
+        m_capture->saved.assign(m_tiles.size(), false);
+    }
+
+    std::vector<TiledSurface::TileState> TiledSurface::endCapture()
+    {
+        if (!m_capture) return {};
+        std::vector<TileState> tiles = std::move(m_capture->tiles);
+        m_capture.reset();
+        return tiles;
+    }
+
+    void TiledSurface::captureTile(int column, int row)
+    {
+        if (!m_capture) return;
+        const int index = tileIndex(column, row);
+        if (m_capture->saved[index]) return;
+        m_capture->saved[index] = true;
+        m_capture->tiles.push_back(saveTile(column, row));
+    }
+
+    void TiledSurface::updateContentBounds(const QRect& area)
+    {
+        int firstColumn, firstRow, lastColumn, lastRow;
+        if (!tileRange(area, firstColumn, firstRow, lastColumn, lastRow)) return;
+
+        const AlphaScanner scanner = alphaScanner(m_format);
+        for (int row = firstRow; row <= lastRow; ++row) {
+            for (int column = firstColumn; column <= lastColumn; ++column) {
+                const int index = tileIndex(column, row);
+                QRect& bounds = m_tileBounds[index];
+                if (m_tiles[index].isNull()) {
+                    bounds = QRect();
+                    m_tileOpaque[index] = false;
+                    continue;
+                }
+
+                // Only the scanned part can have changed; content outside it
+                // keeps its old extent
+                const QImage& tile = m_tiles[index];
+                const QRect tileArea = tileRect(column, row);
+                const QRect scanned = area.intersected(tileArea);
+                const QRect local = scanned.translated(-tileArea.topLeft());
+                const QRect found = scanner.bounds(tile, local).translated(tileArea.topLeft());
+                if (scanned.contains(bounds)) {
+                    bounds = found;
+                } else if (!found.isEmpty()) {
+                    bounds = bounds.united(found);
+                }
+
+                if (bounds.isEmpty()) {
+                    m_tiles[index] = QImage();
+                    m_tileOpaque[index] = false;
+                    continue;
+                }
+
+                // An opaque tile stays opaque if the edited part still is; any
+                // other tile needs a full scan, but only once its content
+                // reaches every edge
+                if (m_tileOpaque[index]) {
+                    m_tileOpaque[index] = scanner.opaque(tile, local);
+                } else if (bounds == tileArea) {
+                    m_tileOpaque[index] = scanner.opaque(tile, tile.rect());
+                }
+            }
+        }
+        uniteContentBounds();
+    }
+
+    bool TiledSurface::isOpaque(const QRect& area) const
+    {
+        if (area.isEmpty() || !rect().contains(area)) return false;
+
+        int firstColumn, firstRow, lastColumn, lastRow;
+        tileRange(area, firstColumn, firstRow, lastColumn, lastRow);
+        for (int row = firstRow; row <= lastRow; ++row) {
+            for (int column = firstColumn; column <= lastColumn; ++column) {
+                if (!m_tileOpaque[tileIndex(column, row)]) return false;
+            }
+        }
+        return true;
+    }
+
+    void TiledSurface::uniteContentBounds()
+    {
+        m_contentBounds = QRect();
+        for (const QRect& bounds : m_tileBounds) {
+            m_contentBounds = m_contentBounds.united(bounds);
+        }
+    }
+
+    bool TiledSurface::tileRange(const QRect& area, int& firstColumn, int& firstRow, int& lastColumn, int& lastRow) const
+    {
+        QRect clipped = area.intersected(rect());
+        if (clipped.isEmpty()) return false;
+
+        firstColumn = clipped.left() / TileSize;
+        firstRow = clipped.top() / TileSize;
+        lastColumn = clipped.right() / TileSize;
+        lastRow = clipped.bottom() / TileSize;
+        return true;
+    }
+
+    void TiledSurface::fill(const QColor& color)
+    {
+        if (color.alpha() == 0) {
+            clear();
+            return;
+        }
+
+        for (int row = 0; row < m_rows; ++row) {
+            for (int column = 0; column < m_columns; ++column) {
+                QImage& tile = tileForWrite(column, row);
+                tile.fill(color);
+                m_tileBounds[tileIndex(column, row)] = tileRect(column, row);
+                m_tileOpaque[tileIndex(column, row)] = color.alpha() == 255;
+            }
+        }
+        m_contentBounds = rect();
+    }
+
+    void TiledSurface::convertToFormat(QImage::Format format)
+    {
+        if (format == m_format) return;
+        m_format = format;
+        for (QImage& tile : m_tiles) {
+            if (!tile.isNull()) {
+                tile = tile.convertToFormat(format);
+            }
+        }
+    }
+
+    void TiledSurface::clear()
+    {
+        for (int row = 0; row < m_rows && m_capture; ++row) {
+            for (int column = 0; column < m_columns; ++column) {
+                captureTile(column, row);
+            }
+        }
+        std::fill(m_tiles.begin(), m_tiles.end(), QImage());
+        std::fill(m_tileBounds.begin(), m_tileBounds.end(), QRect());
+        std::fill(m_tileOpaque.begin(), m_tileOpaque.end(), false);
+        m_contentBounds = QRect();
+    }
+
+    void TiledSurface::paint(const QRect& area, const std::function<void(QPainter&)>& painterFunction)
+    {
+        int firstColumn, firstRow, lastColumn, lastRow;
+        if (!tileRange(area, firstColumn, firstRow, lastColumn, lastRow)) return;
+
+        for (int row = firstRow; row <= lastRow; ++row) {
+            for (int column = firstColumn; column <= lastColumn; ++column) {
+                QRect bounds = tileRect(column, row);
+                QImage& tile = tileForWrite(column, row);
+
+                // Each tile gets its own painter in surface coordinates,
+                // clipped so that work outside the edited area is skipped
+                QPainter painter(&tile);
+                painter.translate(-bounds.topLeft());
+                painter.setClipRect(area.intersected(bounds));
+                painterFunction(painter);
+                painter.end();
+            }
+        }
+        updateContentBounds(area);
+    }
+
+    template <typename RowFunction>
+    QRect TiledSurface::stampDabs(const std::vector<Dab>& dabs, bool createTiles, RowFunction rowFunction)
+    {
+        const int bytesPerPixel = LibreEffects::Core::bytesPerPixel(corePixelFormat(m_format));
+        // Touched part of each tile; a stroke segment only spans a few
+        std::vector<std::pair<int, QRect>> touched;
+        QRect covered;
+
+        for (const Dab& dab : dabs) {
+            Q_ASSERT(dab.coverage.format() == QImage::Format_Alpha8);
+            const QRect area = QRect(dab.position, dab.coverage.size()).intersected(rect());
+            int firstColumn, firstRow, lastColumn, lastRow;
+            if (!tileRange(area, firstColumn, firstRow, lastColumn, lastRow)) continue;
+            covered = covered.united(area);
+
+            for (int row = firstRow; row <= lastRow; ++row) {
+                for (int column = firstColumn; column <= lastColumn; ++column) {
+                    const QRect bounds = tileRect(column, row);
+                    const QRect overlap = area.intersected(bounds);
+                    const int index = tileIndex(column, row);
+                    if (!createTiles && !m_tileBounds[index].intersects(overlap)) continue;
+
+                    QImage& tile = tileForWrite(column, row);
+                    for (int y = overlap.top(); y <= overlap.bottom(); ++y) {
+                        uchar* pixels = tile.scanLine(y - bounds.y()) + (overlap.x() - bounds.x()) * bytesPerPixel;
+                        const uchar* coverage = dab.coverage.constScanLine(y - dab.position.y()) + (overlap.x() - dab.position.x());
+                        rowFunction(pixels, coverage, overlap.width());
+                    }
+
+                    auto it = std::find_if(touched.begin(), touched.end(),
+                                           [index](const std::pair<int, QRect>& entry) { return entry.first == index; });
+                    if (it == touched.end()) {
+                        touched.emplace_back(index, overlap);
+                    } else {
+                        it->second = it->second.united(overlap);
+                    }
+                }
+            }
+        }
+
+        // One rescan per tile rather than per dab, since consecutive dabs
+        // mostly overlap
+        for (const auto& entry : touched) {
+            updateContentBounds(entry.second);
+        }
+        return covered;
+    }
+
+    QRect TiledSurface::drawDabs(const std::vector<Dab>& dabs, const QColor& color, float opacity,
+                                 LibreEffects::Core::BlendSpace space)
+    {
+        const auto dabRow = LibreEffects::Core::dabRowFunction(corePixelFormat(m_format), space);
+        const float alpha = color.alphaF();
+        const float premultiplied[4] = { static_cast<float>(color.redF()) * alpha,
+                                         static_cast<float>(color.greenF()) * alpha,
+                                         static_cast<float>(color.blueF()) * alpha, alpha };
+        float dabColor[4];
+        LibreEffects::Core::dabColor(space, premultiplied, dabColor);
+        return stampDabs(dabs, true, [&](uchar* pixels, const uchar* coverage, int count) {
+            dabRow(pixels, coverage, count, dabColor, opacity);
+        });
+    }
+
+    QRect TiledSurface::eraseDabs(const std::vector<Dab>& dabs, float opacity)
+    {
+        const auto eraseRow = LibreEffects::Core::eraseRowFunction(corePixelFormat(m_format));
+        return stampDabs(dabs, false, [&](uchar* pixels, const uchar* coverage, int count) {
+            eraseRow(pixels, coverage, count, opacity);
+        });
+    }
+
+    void TiledSurface::setImage(const QImage& image)
+    {
+        // The saved tiles only fit a grid of the same size
+        std::shared_ptr<Capture> capture;
+        if (m_capture && image.size() == m_size) {
+            clear();
+            capture = m_capture;
+        }
+        *this = TiledSurface(image.width(), image.height(), m_format);
+        m_capture = capture;
+        if (image.isNull()) return;
+
+        QImage source = image.format() == m_format ? image : image.convertToFormat(m_format);
+        for (int row = 0; row < m_rows; ++row) {
+            for (int column = 0; column < m_columns; ++column) {
+                m_tiles[tileIndex(column, row)] = source.copy(tileRect(column, row));
+            }
+        }
+        updateContentBounds(rect());
+    }
+
+    QImage TiledSurface::toImage() const
+    {
+        return copy(rect());
+    }
+
+    QImage TiledSurface::copy(const QRect& area) const
+    {
+        QImage result(area.size(), m_format);
+        result.fill(Qt::transparent);
+
+        int firstColumn, firstRow, lastColumn, lastRow;
+        if (!tileRange(area, firstColumn, firstRow, lastColumn, lastRow)) return result;
+
+        QPainter painter(&result);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        for (int row = firstRow; row <= lastRow; ++row) {
+            for (int column = firstColumn; column <= lastColumn; ++column) {
+                const QImage& tile = m_tiles[tileIndex(column, row)];
+                if (tile.isNull()) continue;
+                painter.drawImage(tileRect(column, row).topLeft() - area.topLeft(), tile);
+            }
+        }
+        painter.end();
+        return result;
+    }
+
+    QImage TiledSurface::createTile(int column, int row) const
+    {
+        QImage tile(tileRect(column, row).size(), m_format);
+        tile.fill(Qt::transparent);
+        return tile;
+    }
+
+} // namespace LibreCanvas
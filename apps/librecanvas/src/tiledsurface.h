@@ -0,0 +1,140 @@
+#pragma once
+
+#include <QImage>
+#include <QRect>
+#include <QColor>
+#include <QPainter>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "core/blend.h"
+
+namespace LibreCanvas {
+
+    // Sparse grid of fixed-size tiles backing a layer's pixels.
+    // Tiles that were never written stay null and read as fully transparent,
+    // so painting, compositing and history only have to touch the tiles
+    // that actually hold content. Tiles default to premultiplied ARGB32, the
+    // format the compositor blends in. Each tile also keeps a box around its
+    // non-transparent pixels so callers can skip empty space cheaply.
+    // Copies share tiles through QImage's implicit sharing; a tile is only
+    // duplicated when one side writes to it.
+    class TiledSurface {
+    public:
+        static constexpr int TileSize = 256;
+
+        // A tile together with its bookkeeping, so it can be put back as is
+        struct TileState {
+            int column;
+            int row;
+            QImage image;
+            QRect bounds;
+            bool opaque;
+        };
+
+        TiledSurface();
+        TiledSurface(int width, int height, QImage::Format format = QImage::Format_ARGB32_Premultiplied);
+        explicit TiledSurface(const QImage& image);
+
+        QSize getSize() const { return m_size; }
+        int width() const { return m_size.width(); }
+        int height() const { return m_size.height(); }
+        QRect rect() const { return QRect(QPoint(0, 0), m_size); }
+        bool isNull() const { return m_size.isEmpty(); }
+        QImage::Format getFormat() const { return m_format; }
+        void convertToFormat(QImage::Format format);
+
+        // Tile grid
+        int getColumns() const { return m_columns; }
+        int getRows() const { return m_rows; }
+        QRect tileRect(int column, int row) const;
+        bool hasTile(int column, int row) const { return !m_tiles[tileIndex(column, row)].isNull(); }
+        const QImage& tile(int column, int row) const { return m_tiles[tileIndex(column, row)]; }
+        QImage& tileForWrite(int column, int row);
+        void dropTile(int column, int row);
+        // Tile pixels without the bookkeeping around them, for paging
+        // history out and back in. A slot emptied this way keeps its
+        // content bounds, so the surface must not be used until the same
+        // pixels are put back.
+        QImage& tileStorage(int column, int row) { return m_tiles[tileIndex(column, row)]; }
+
+        TileState saveTile(int column, int row) const;
+        void restoreTiles(const std::vector<TileState>& tiles);
+
+        // Edit capture: until endCapture(), the first write to each tile
+        // saves it as it was. Saving keeps a handle, not a copy; the write
+        // itself detaches the tile. setImage() to another size ends it.
+        void beginCapture();
+        std::vector<TileState> endCapture();
+        bool isCapturing() const { return m_capture != nullptr; }
+
+        // Boxes around non-transparent pixels, in surface coordinates. They
+        // may be larger than the content after erasing, never smaller.
+        QRect getContentBounds() const { return m_contentBounds; }
+        QRect tileContentBounds(int column, int row) const { return m_tileBounds[tileIndex(column, row)]; }
+
+        // Rescans the tiles touching area after writing through
+        // tileForWrite(); paint() and the other editing calls do this
+        // themselves. Tiles left fully transparent are dropped.
+        void updateContentBounds(const QRect& area);
+
+        // Whether every pixel of area has full alpha, judged per tile
+        bool isTileOpaque(int column, int row) const { return m_tileOpaque[tileIndex(column, row)]; }
+        bool isOpaque(const QRect& area) const;
+
+        // Range of tiles overlapping a rectangle in surface coordinates
+        bool tileRange(const QRect& area, int& firstColumn, int& firstRow, int& lastColumn, int& lastRow) const;
+
+        // Editing
+        void fill(const QColor& color);
+        void clear();
+        void paint(const QRect& area, const std::function<void(QPainter&)>& painterFunction);
+
+        // A brush stamp placed on the surface: Alpha8 coverage with its
+        // top-left pixel at position
+        struct Dab {
+            QImage coverage;
+            QPoint position;
+        };
+
+        // Brush dabs composited straight into the tile rows by the core dab
+        // kernels, in order, with color and opacity applied in the same
+        // pass. Both return the area the dabs cover. Erasing never creates
+        // tiles, and skips tiles with nothing under the dab.
+        QRect drawDabs(const std::vector<Dab>& dabs, const QColor& color, float opacity,
+                       LibreEffects::Core::BlendSpace space);
+        QRect eraseDabs(const std::vector<Dab>& dabs, float opacity);
+
+        // Whole-image compatibility path
+        void setImage(const QImage& image);
+        QImage toImage() const;
+        QImage copy(const QRect& area) const;
+
+    private:
+        int tileIndex(int column, int row) const { return row * m_columns + column; }
+        QImage createTile(int column, int row) const;
+        void uniteContentBounds();
+        void captureTile(int column, int row);
+        // Runs rowFunction(pixels, coverage, count) over every row of every
+        // dab within the surface, then rescans the touched part of each tile
+        template <typename RowFunction>
+        QRect stampDabs(const std::vector<Dab>& dabs, bool createTiles, RowFunction rowFunction);
+
+        struct Capture {
+            std::vector<bool> saved;
+            std::vector<TileState> tiles;
+        };
+
+        QSize m_size;
+        QImage::Format m_format;
+        int m_columns;
+        int m_rows;
+        std::vector<QImage> m_tiles;
+        std::vector<QRect> m_tileBounds;
+        std::vector<bool> m_tileOpaque;
+        QRect m_contentBounds;
+        // Shared by copies made while capturing, which only read
+        std::shared_ptr<Capture> m_capture;
+    };
+
+} // namespace LibreCanvas
@@ -1,7 +1,6 @@
 #include "tool.h"
 #include <QPainter>
 #include <QPainterPath>
-#include <QRadialGradient>
 #include <QQueue>
 #include <QSet>
 #include <cmath>
@@ -9,6 +8,13 @@
 
 namespace LibreCanvas {
 
+    QRect Tool::dabBounds(const QPoint& from, const QPoint& to, int size)
+    {
+        // Pad by one pixel for antialiased edges
+        int radius = size / 2 + 1;
+        return QRect(from, to).normalized().adjusted(-radius, -radius, radius, radius);
+    }
+
     // Brush Tool Implementation
     void BrushTool::onMousePress(QMouseEvent *event, std::shared_ptr<Document> doc, const QPoint& imagePos)
     {
@@ -18,17 +24,10 @@ namespace LibreCanvas {
         if (!activeLayer || activeLayer->isLocked()) return;
         
         m_isDrawing = true;
-        m_lastPos = imagePos;
-        
-        QImage& layerImage = activeLayer->getImage();
-        QPainter painter(&layerImage);
-        painter.setRenderHint(QPainter::Antialiasing);
-        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-        
-        drawBrush(painter, imagePos, m_size, m_hardness, m_color, m_opacity);
-        painter.end();
+        m_spacer.begin(m_imagePosition);
         
-        // Note: History is saved in canvas widget before tool operation
+        // Dabs are composited straight into the layer's tiles, in the document's space
+        activeLayer->drawDabs({ dabAt(m_imagePosition) }, m_color, m_opacity * m_flow, doc->getBlendSpace());
     }
 
     void BrushTool::onMouseMove(QMouseEvent *event, std::shared_ptr<Document> doc, const QPoint& imagePos)
@@ -38,27 +37,16 @@ namespace LibreCanvas {
         auto activeLayer = doc->getActiveLayer();
         if (!activeLayer || activeLayer->isLocked()) return;
         
-        QImage& layerImage = activeLayer->getImage();
-        QPainter painter(&layerImage);
-        painter.setRenderHint(QPainter::Antialiasing);
-        painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+        // Dabs a fixed distance apart, however far the pointer moved
+        const std::vector<QPointF> positions = m_spacer.moveTo(m_imagePosition, StrokeSpacer::spacingFor(m_size, m_spacing));
+        if (positions.empty()) return;
         
-        // Draw line between last position and current
-        QPoint p1 = m_lastPos;
-        QPoint p2 = imagePos;
-        int steps = qMax(abs(p2.x() - p1.x()), abs(p2.y() - p1.y()));
-        
-        for (int i = 0; i <= steps; ++i) {
-            float t = static_cast<float>(i) / steps;
-            QPoint pos(
-                static_cast<int>(p1.x() * (1.0f - t) + p2.x() * t),
-                static_cast<int>(p1.y() * (1.0f - t) + p2.y() * t)
-            );
-            drawBrush(painter, pos, m_size, m_hardness, m_color, m_opacity * m_flow);
+        std::vector<TiledSurface::Dab> dabs;
+        dabs.reserve(positions.size());
+        for (const QPointF& pos : positions) {
+            dabs.push_back(dabAt(pos));
         }
-        
-        m_lastPos = imagePos;
-        painter.end();
+        activeLayer->drawDabs(dabs, m_color, m_opacity * m_flow, doc->getBlendSpace());
     }
 
     void BrushTool::onMouseRelease(QMouseEvent *event, std::shared_ptr<Document> doc, const QPoint& imagePos)
@@ -66,31 +54,11 @@ namespace LibreCanvas {
         m_isDrawing = false;
     }
 
-    void BrushTool::drawBrush(QPainter& painter, const QPoint& pos, int size, float hardness, const QColor& color, float opacity)
+    TiledSurface::Dab BrushTool::dabAt(const QPointF& pos)
     {
-        QColor brushColor = color;
-        brushColor.setAlphaF(color.alphaF() * opacity);
-        
-        if (hardness >= 1.0f) {
-            // Hard brush
-            painter.setPen(Qt::NoPen);
-            painter.setBrush(brushColor);
-            painter.drawEllipse(pos, size / 2, size / 2);
-        } else {
-            // Soft brush with gradient
-            QRadialGradient gradient(pos, size / 2.0f);
-            float softEdge = size * (1.0f - hardness) / 2.0f;
-            
-            gradient.setColorAt(0.0, brushColor);
-            gradient.setColorAt(hardness, brushColor);
-            QColor transparent = brushColor;
-            transparent.setAlphaF(0.0f);
-            gradient.setColorAt(1.0, transparent);
-            
-            painter.setPen(Qt::NoPen);
-            painter.setBrush(gradient);
-            painter.drawEllipse(pos, size / 2, size / 2);
-        }
+        // The stamp is rasterized once per size and hardness; each dab only composites it
+        auto stamp = m_stamps.get(m_size, m_hardness, pos);
+        return { stamp->getCoverage(), stamp->topLeft(pos) };
     }
 
     // Eraser Tool Implementation
@@ -102,15 +70,9 @@ namespace LibreCanvas {
         if (!activeLayer || activeLayer->isLocked()) return;
         
         m_isErasing = true;
-        m_lastPos = imagePos;
+        m_spacer.begin(m_imagePosition);
         
-        QImage& layerImage = activeLayer->getImage();
-        QPainter painter(&layerImage);
-        painter.setRenderHint(QPainter::Antialiasing);
-        painter.setCompositionMode(QPainter::CompositionMode_DestinationOut);
-        
-        eraseBrush(painter, imagePos, m_size, m_hardness, m_opacity);
-        painter.end();
+        activeLayer->eraseDabs({ dabAt(m_imagePosition) }, m_opacity);
     }
 
     void EraserTool::onMouseMove(QMouseEvent *event, std::shared_ptr<Document> doc, const QPoint& imagePos)
@@ -120,26 +82,15 @@ namespace LibreCanvas {
         auto activeLayer = doc->getActiveLayer();
         if (!activeLayer || activeLayer->isLocked()) return;
         
-        QImage& layerImage = activeLayer->getImage();
-        QPainter painter(&layerImage);
-        painter.setRenderHint(QPainter::Antialiasing);
-        painter.setCompositionMode(QPainter::CompositionMode_DestinationOut);
-        
-        QPoint p1 = m_lastPos;
-        QPoint p2 = imagePos;
-        int steps = qMax(abs(p2.x() - p1.x()), abs(p2.y() - p1.y()));
+        const std::vector<QPointF> positions = m_spacer.moveTo(m_imagePosition, StrokeSpacer::spacingFor(m_size, m_spacing));
+        if (positions.empty()) return;
         
-        for (int i = 0; i <= steps; ++i) {
-            float t = static_cast<float>(i) / steps;
-            QPoint pos(
-                static_cast<int>(p1.x() * (1.0f - t) + p2.x() * t),
-                static_cast<int>(p1.y() * (1.0f - t) + p2.y() * t)
-            );
-            eraseBrush(painter, pos, m_size, m_hardness, m_opacity);
+        std::vector<TiledSurface::Dab> dabs;
+        dabs.reserve(positions.size());
+        for (const QPointF& pos : positions) {
+            dabs.push_back(dabAt(pos));
         }
-        
-        m_lastPos = imagePos;
-        painter.end();
+        activeLayer->eraseDabs(dabs, m_opacity);
     }
 
     void EraserTool::onMouseRelease(QMouseEvent *event, std::shared_ptr<Document> doc, const QPoint& imagePos)
@@ -147,25 +98,10 @@ namespace LibreCanvas {
         m_isErasing = false;
     }
 
-    void EraserTool::eraseBrush(QPainter& painter, const QPoint& pos, int size, float hardness, float opacity)
+    TiledSurface::Dab EraserTool::dabAt(const QPointF& pos)
     {
-        QColor eraseColor(0, 0, 0, static_cast<int>(255 * opacity));
-        
-        if (hardness >= 1.0f) {
-            painter.setPen(Qt::NoPen);
-            painter.setBrush(eraseColor);
-            painter.drawEllipse(pos, size / 2, size / 2);
-        } else {
-            QRadialGradient gradient(pos, size / 2.0f);
-            gradient.setColorAt(0.0, eraseColor);
-            gradient.setColorAt(hardness, eraseColor);
-            QColor transparent(0, 0, 0, 0);
-            gradient.setColorAt(1.0, transparent);
-            
-            painter.setPen(Qt::NoPen);
-            painter.setBrush(gradient);
-            painter.drawEllipse(pos, size / 2, size / 2);
-        }
+        auto stamp = m_stamps.get(m_size, m_hardness, pos);
+        return { stamp->getCoverage(), stamp->topLeft(pos) };
     }
 
     // Marquee Rect Tool Implementation
@@ -199,7 +135,7 @@ namespace LibreCanvas {
         auto activeLayer = doc->getActiveLayer();
         if (!activeLayer) return;
         
-        const QImage& image = activeLayer->getImage();
+        const QImage image = activeLayer->getImage();
         if (imagePos.x() < 0 || imagePos.x() >= image.width() ||
             imagePos.y() < 0 || imagePos.y() >= image.height()) {
             return;
@@ -9,6 +9,8 @@
 #include <memory>
 #include "document.h"
 #include "layer.h"
+#include "brushstamp.h"
+#include "strokespacer.h"
 
 namespace LibreCanvas {
 
@@ -43,6 +45,14 @@ namespace LibreCanvas {
         ToolType getType() const { return m_type; }
         virtual QString getName() const = 0;
         virtual QCursor getCursor() const { return Qt::ArrowCursor; }
+        // Tools that record their own history steps; the canvas snapshots
+        // the document around every other tool's strokes
+        virtual bool recordsHistory() const { return false; }
+
+        // Image position of the event being handled, before imagePos rounds
+        // it to a pixel; the canvas sets it ahead of each mouse handler
+        QPointF getImagePosition() const { return m_imagePosition; }
+        void setImagePosition(const QPointF& position) { m_imagePosition = position; }
 
         virtual void onMousePress(QMouseEvent *event, std::shared_ptr<Document> doc, const QPoint& imagePos) {}
         virtual void onMouseMove(QMouseEvent *event, std::shared_ptr<Document> doc, const QPoint& imagePos) {}
@@ -51,7 +61,11 @@ namespace LibreCanvas {
         virtual void onKeyRelease(QKeyEvent *event) {}
 
     protected:
+        // Area covered by dabs of the given size stamped along a segment
+        static QRect dabBounds(const QPoint& from, const QPoint& to, int size);
+
         ToolType m_type;
+        QPointF m_imagePosition;
     };
 
     class BrushTool : public Tool {
@@ -69,16 +83,20 @@ namespace LibreCanvas {
         void setOpacity(float opacity) { m_opacity = qBound(0.0f, opacity, 1.0f); }
         void setFlow(float flow) { m_flow = qBound(0.0f, flow, 1.0f); }
         void setColor(const QColor& color) { m_color = color; }
+        // Distance between dabs as a fraction of the brush size
+        void setSpacing(float spacing) { m_spacing = qBound(0.01f, spacing, 10.0f); }
 
     private:
-        void drawBrush(QPainter& painter, const QPoint& pos, int size, float hardness, const QColor& color, float opacity);
+        TiledSurface::Dab dabAt(const QPointF& pos);
         
+        BrushStampCache m_stamps;
+        StrokeSpacer m_spacer;
         int m_size = 20;
         float m_hardness = 1.0f;
         float m_opacity = 1.0f;
         float m_flow = 1.0f;
+        float m_spacing = 0.1f;
         QColor m_color = Qt::black;
-        QPoint m_lastPos;
         bool m_isDrawing = false;
     };
 
@@ -95,14 +113,17 @@ namespace LibreCanvas {
         void setSize(int size) { m_size = size; }
         void setHardness(float hardness) { m_hardness = qBound(0.0f, hardness, 1.0f); }
         void setOpacity(float opacity) { m_opacity = qBound(0.0f, opacity, 1.0f); }
+        void setSpacing(float spacing) { m_spacing = qBound(0.01f, spacing, 10.0f); }
 
     private:
-        void eraseBrush(QPainter& painter, const QPoint& pos, int size, float hardness, float opacity);
+        TiledSurface::Dab dabAt(const QPointF& pos);
         
+        BrushStampCache m_stamps;
+        StrokeSpacer m_spacer;
         int m_size = 20;
         float m_hardness = 1.0f;
         float m_opacity = 1.0f;
-        QPoint m_lastPos;
+        float m_spacing = 0.1f;
         bool m_isErasing = false;
     };
 
@@ -119,6 +119,22 @@ void ToolPanel::setupUI()
     hardnessLayout->addWidget(m_hardnessLabel);
     brushLayout->addLayout(hardnessLayout);
     
+    // Spacing between dabs, as a percentage of the brush size
+    QHBoxLayout *spacingLayout = new QHBoxLayout();
+    spacingLayout->addWidget(new QLabel("Spacing:", this));
+    m_spacingSlider = new QSlider(Qt::Horizontal, this);
+    m_spacingSlider->setRange(1, 200);
+    m_spacingSlider->setValue(10);
+    connect(m_spacingSlider, &QSlider::valueChanged, this, &ToolPanel::onBrushSpacingChanged);
+    spacingLayout->addWidget(m_spacingSlider);
+    m_spacingLabel = new QLabel("10%", this);
+    m_spacingLabel->setMinimumWidth(40);
+    connect(m_spacingSlider, &QSlider::valueChanged, m_spacingLabel, [this](int value) {
+        m_spacingLabel->setText(QString("%1%").arg(value));
+    });
+    spacingLayout->addWidget(m_spacingLabel);
+    brushLayout->addLayout(spacingLayout);
+    
     // Opacity
     QHBoxLayout *opacityLayout = new QHBoxLayout();
     opacityLayout->addWidget(new QLabel("Opacity:", this));
@@ -219,11 +235,13 @@ void ToolPanel::onToolButtonClicked(int id)
         if (auto brushTool = std::dynamic_pointer_cast<LibreCanvas::BrushTool>(tool)) {
             brushTool->setSize(m_sizeSlider->value());
             brushTool->setHardness(m_hardnessSlider->value() / 100.0f);
+            brushTool->setSpacing(m_spacingSlider->value() / 100.0f);
             brushTool->setOpacity(m_opacitySlider->value() / 100.0f);
             brushTool->setColor(m_brushColor);
         } else if (auto eraserTool = std::dynamic_pointer_cast<LibreCanvas::EraserTool>(tool)) {
             eraserTool->setSize(m_sizeSlider->value());
             eraserTool->setHardness(m_hardnessSlider->value() / 100.0f);
+            eraserTool->setSpacing(m_spacingSlider->value() / 100.0f);
             eraserTool->setOpacity(m_opacitySlider->value() / 100.0f);
         }
         
@@ -256,6 +274,17 @@ void ToolPanel::onBrushHardnessChanged(int value)
     }
 }
 
+void ToolPanel::onBrushSpacingChanged(int value)
+{
+    float spacing = value / 100.0f;
+    emit brushSpacingChanged(spacing);
+    if (auto brushTool = std::dynamic_pointer_cast<LibreCanvas::BrushTool>(m_currentTool)) {
+        brushTool->setSpacing(spacing);
+    } else if (auto eraserTool = std::dynamic_pointer_cast<LibreCanvas::EraserTool>(m_currentTool)) {
+        eraserTool->setSpacing(spacing);
+    }
+}
+
 void ToolPanel::onBrushOpacityChanged(int value)
 {
     float opacity = value / 100.0f;
@@ -27,6 +27,7 @@ signals:
     void toolChanged(std::shared_ptr<LibreCanvas::Tool> tool);
     void brushSizeChanged(int size);
     void brushHardnessChanged(float hardness);
+    void brushSpacingChanged(float spacing);
     void brushOpacityChanged(float opacity);
     void brushColorChanged(const QColor& color);
 
@@ -34,6 +35,7 @@ private slots:
     void onToolButtonClicked(int id);
     void onBrushSizeChanged(int value);
     void onBrushHardnessChanged(int value);
+    void onBrushSpacingChanged(int value);
     void onBrushOpacityChanged(int value);
     void onColorButtonClicked();
 
@@ -49,10 +51,12 @@ private:
     
     QSlider *m_sizeSlider;
     QSlider *m_hardnessSlider;
+    QSlider *m_spacingSlider;
     QSlider *m_opacitySlider;
     QPushButton *m_colorBtn;
     QLabel *m_sizeLabel;
     QLabel *m_hardnessLabel;
+    QLabel *m_spacingLabel;
     QLabel *m_opacityLabel;
     
     std::shared_ptr<LibreCanvas::Tool> m_currentTool;
@@ -1,5 +1,6 @@
 #include "transformtool.h"
 #include "document.h"
+#include "history.h"
 #include <QMouseEvent>
 #include <QKeyEvent>
 #include <QPainter>
@@ -136,20 +137,25 @@ namespace LibreCanvas {
             auto layer = doc->getActiveLayer();
             
             if (m_mode == TransformMode::Move) {
+                // Moving changes no pixels; history keeps just the offsets
+                const LayerProperties before = LayerProperties::of(*layer);
                 QPoint offset = m_currentBounds.topLeft() - m_originalBounds.topLeft();
                 layer->setOffset(layer->getOffset() + offset);
+                const LayerProperties after = LayerProperties::of(*layer);
+                if (after != before) {
+                    doc->recordCommand(std::make_shared<LayerPropertyCommand>(layer->getId(), before, after), "Move Layer");
+                }
             } else if (m_mode >= TransformMode::ScaleTopLeft && m_mode <= TransformMode::ScaleRight) {
                 // Scale the layer image
                 QImage originalImage = layer->getImage();
                 QSize newSize = m_currentBounds.size();
                 if (newSize.width() > 0 && newSize.height() > 0) {
                     QImage scaled = originalImage.scaled(newSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
-                    layer->getImage() = scaled;
+                    layer->setImage(scaled);
                     layer->setOffset(m_currentBounds.topLeft());
+                    doc->saveState("Transform");
                 }
             }
-
-            doc->saveState("Transform");
         }
 
         m_isTransforming = false;
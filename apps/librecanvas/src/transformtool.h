@@ -27,6 +27,7 @@ namespace LibreCanvas {
 
         QString getName() const override { return "Transform"; }
         QCursor getCursor() const override;
+        bool recordsHistory() const override { return true; }
 
         void onMousePress(QMouseEvent* event, std::shared_ptr<Document> doc, const QPoint& imagePos) override;
         void onMouseMove(QMouseEvent* event, std::shared_ptr<Document> doc, const QPoint& imagePos) override;
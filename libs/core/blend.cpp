@@ -0,0 +1,302 @@
+#include "blend_table.h"
+#include <cmath>
+
+namespace LibreEffects::Core {
+
+    // Portable fallback: one pixel per iteration
+    namespace Scalar {
+
+        using V = float;
+        constexpr int Lanes = 1;
+        constexpr SimdLevel Narrower = SimdLevel::Scalar;
+
+        inline float vmin(float a, float b) { return a < b ? a : b; }
+        inline float vmax(float a, float b) { return a > b ? a : b; }
+        inline float vsqrt(float a) { return std::sqrt(a); }
+        inline float vfloor(float a) { return std::floor(a); }
+        inline float vgather(const float* table, float index) { return table[static_cast<int>(index)]; }
+        inline bool vle(float a, float b) { return a <= b; }
+        inline bool vge(float a, float b) { return a >= b; }
+        inline float vselect(bool mask, float a, float b) { return mask ? a : b; }
+
+        inline void loadArgb32(const uint32_t* p, float& b, float& g, float& r, float& a)
+        {
+            const float scale = 1.0f / 255.0f;
+            b = static_cast<float>(*p & 0xff) * scale;
+            g = static_cast<float>((*p >> 8) & 0xff) * scale;
+            r = static_cast<float>((*p >> 16) & 0xff) * scale;
+            a = static_cast<float>(*p >> 24) * scale;
+        }
+
+        inline uint32_t toByte(float v)
+        {
+            return static_cast<uint32_t>(static_cast<int>(v * 255.0f + 0.5f));
+        }
+
+        inline void storeArgb32(uint32_t* p, float b, float g, float r, float a)
+        {
+            *p = toByte(b) | (toByte(g) << 8) | (toByte(r) << 16) | (toByte(a) << 24);
+        }
+
+        inline bool isTransparentArgb32(const uint32_t* p)
+        {
+            return (*p >> 24) == 0;
+        }
+
+        inline void loadRgba64(const Rgba64* p, float& r, float& g, float& b, float& a)
+        {
+            const float scale = 1.0f / 65535.0f;
+            r = static_cast<float>(p->r) * scale;
+            g = static_cast<float>(p->g) * scale;
+            b = static_cast<float>(p->b) * scale;
+            a = static_cast<float>(p->a) * scale;
+        }
+
+        inline uint16_t toWord(float v)
+        {
+            return static_cast<uint16_t>(static_cast<int>(v * 65535.0f + 0.5f));
+        }
+
+        inline void storeRgba64(Rgba64* p, float r, float g, float b, float a)
+        {
+            *p = { toWord(r), toWord(g), toWord(b), toWord(a) };
+        }
+
+        inline bool isTransparentRgba64(const Rgba64* p)
+        {
+            return p->a == 0;
+        }
+
+        inline void loadRgbaF32(const RgbaF32* p, float& r, float& g, float& b, float& a)
+        {
+            r = p->r;
+            g = p->g;
+            b = p->b;
+            a = p->a;
+        }
+
+        inline void storeRgbaF32(RgbaF32* p, float r, float g, float b, float a)
+        {
+            *p = { r, g, b, a };
+        }
+
+        inline bool isTransparentRgbaF32(const RgbaF32* p)
+        {
+            return p->a == 0.0f;
+        }
+
+        inline void loadMask8(const uint8_t* p, float& m)
+        {
+            m = static_cast<float>(*p) * (1.0f / 255.0f);
+        }
+
+#include "blend_kernels.h"
+
+    } // namespace Scalar
+
+#if defined(LIBREEFFECTS_CORE_X86_SIMD)
+    namespace Sse41 {
+        void fillKernelTable(KernelTable& table);
+    }
+    namespace Avx2 {
+        void fillKernelTable(KernelTable& table);
+    }
+#endif
+
+    namespace {
+
+        struct KernelTables {
+            KernelTable levels[3];
+
+            KernelTables()
+            {
+                Scalar::populateKernelTable(levels[static_cast<int>(SimdLevel::Scalar)]);
+#if defined(LIBREEFFECTS_CORE_X86_SIMD)
+                Sse41::fillKernelTable(levels[static_cast<int>(SimdLevel::SSE41)]);
+                Avx2::fillKernelTable(levels[static_cast<int>(SimdLevel::AVX2)]);
+#else
+                Scalar::populateKernelTable(levels[static_cast<int>(SimdLevel::SSE41)]);
+                Scalar::populateKernelTable(levels[static_cast<int>(SimdLevel::AVX2)]);
+#endif
+            }
+        };
+
+    } // namespace
+
+    const KernelTable& kernelTable(SimdLevel level)
+    {
+        static const KernelTables tables;
+        if (static_cast<int>(level) > static_cast<int>(detectSimdLevel())) {
+            level = detectSimdLevel();
+        }
+        return tables.levels[static_cast<int>(level)];
+    }
+
+    int bytesPerPixel(PixelFormat format)
+    {
+        switch (format) {
+            case PixelFormat::ARGB32: return 4;
+            case PixelFormat::RGBA64: return 8;
+            case PixelFormat::RGBA32F: return 16;
+        }
+        return 4;
+    }
+
+    BlendRowFunction blendRowFunction(PixelFormat format, BlendMode mode, BlendSpace space, SimdLevel level)
+    {
+        return kernelTable(level).formats[static_cast<int>(format)].blend[static_cast<int>(space)][static_cast<int>(mode)];
+    }
+
+    BlendRowFunction blendRowFunction(PixelFormat format, BlendMode mode, BlendSpace space)
+    {
+        return blendRowFunction(format, mode, space, activeSimdLevel());
+    }
+
+    BlendRowFunction blendRowFunction(PixelFormat format, BlendMode mode, SimdLevel level)
+    {
+        return blendRowFunction(format, mode, BlendSpace::Srgb, level);
+    }
+
+    BlendRowFunction blendRowFunction(PixelFormat format, BlendMode mode)
+    {
+        return blendRowFunction(format, mode, BlendSpace::Srgb, activeSimdLevel());
+    }
+
+    BlendRowFunction blendRowFunction(BlendMode mode, SimdLevel level)
+    {
+        return blendRowFunction(PixelFormat::ARGB32, mode, level);
+    }
+
+    BlendRowFunction blendRowFunction(BlendMode mode)
+    {
+        return blendRowFunction(PixelFormat::ARGB32, mode, activeSimdLevel());
+    }
+
+    MaskedBlendRowFunction maskedBlendRowFunction(PixelFormat format, BlendMode mode, BlendSpace space,
+                                                  SimdLevel level)
+    {
+        return kernelTable(level).formats[static_cast<int>(format)].maskedBlend[static_cast<int>(space)][static_cast<int>(mode)];
+    }
+
+    MaskedBlendRowFunction maskedBlendRowFunction(PixelFormat format, BlendMode mode, BlendSpace space)
+    {
+        return maskedBlendRowFunction(format, mode, space, activeSimdLevel());
+    }
+
+    MaskedBlendRowFunction maskedBlendRowFunction(PixelFormat format, BlendMode mode, SimdLevel level)
+    {
+        return maskedBlendRowFunction(format, mode, BlendSpace::Srgb, level);
+    }
+
+    MaskedBlendRowFunction maskedBlendRowFunction(PixelFormat format, BlendMode mode)
+    {
+        return maskedBlendRowFunction(format, mode, BlendSpace::Srgb, activeSimdLevel());
+    }
+
+    MaskedBlendRowFunction maskedBlendRowFunction(BlendMode mode, SimdLevel level)
+    {
+        return maskedBlendRowFunction(PixelFormat::ARGB32, mode, level);
+    }
+
+    MaskedBlendRowFunction maskedBlendRowFunction(BlendMode mode)
+    {
+        return maskedBlendRowFunction(PixelFormat::ARGB32, mode, activeSimdLevel());
+    }
+
+    void maskAlphaRow(uint32_t* pixels, const uint8_t* mask, int count)
+    {
+        kernelTable(activeSimdLevel()).maskAlpha(pixels, mask, count);
+    }
+
+    void maskPremultipliedRow(PixelFormat format, void* pixels, const uint8_t* mask, int count)
+    {
+        kernelTable(activeSimdLevel()).formats[static_cast<int>(format)].maskPremultiplied(pixels, mask, count);
+    }
+
+    void maskPremultipliedRow(uint32_t* pixels, const uint8_t* mask, int count)
+    {
+        maskPremultipliedRow(PixelFormat::ARGB32, pixels, mask, count);
+    }
+
+    DabRowFunction dabRowFunction(PixelFormat format, BlendSpace space, SimdLevel level)
+    {
+        return kernelTable(level).formats[static_cast<int>(format)].dab[static_cast<int>(space)];
+    }
+
+    DabRowFunction dabRowFunction(PixelFormat format, BlendSpace space)
+    {
+        return dabRowFunction(format, space, activeSimdLevel());
+    }
+
+    void dabColor(BlendSpace space, const float* color, float* out)
+    {
+        // The scalar curve gives the same color whichever level paints it
+        float r = color[0], g = color[1], b = color[2];
+        if (space == BlendSpace::Linear) {
+            Scalar::transferPixels(srgbToLinearTable(), r, g, b, color[3]);
+        }
+        out[0] = r;
+        out[1] = g;
+        out[2] = b;
+        out[3] = color[3];
+    }
+
+    EraseRowFunction eraseRowFunction(PixelFormat format, SimdLevel level)
+    {
+        return kernelTable(level).formats[static_cast<int>(format)].erase;
+    }
+
+    EraseRowFunction eraseRowFunction(PixelFormat format)
+    {
+        return eraseRowFunction(format, activeSimdLevel());
+    }
+
+    void premultiplyRow(uint32_t* dst, const uint32_t* src, int count)
+    {
+        // Same rounding as Qt's qPremultiply, so results match QImage conversions
+        for (int i = 0; i < count; ++i) {
+            const uint32_t x = src[i];
+            const uint32_t a = x >> 24;
+            if (a == 255) {
+                dst[i] = x;
+                continue;
+            }
+            uint32_t t = (x & 0xff00ff) * a;
+            t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+            t &= 0xff00ff;
+            uint32_t g = ((x >> 8) & 0xff) * a;
+            g = (g + ((g >> 8) & 0xff) + 0x80);
+            g &= 0xff00;
+            dst[i] = g | t | (a << 24);
+        }
+    }
+
+    const char* blendModeName(BlendMode mode)
+    {
+        switch (mode) {
+            case BlendMode::Normal: return "Normal";
+            case BlendMode::Multiply: return "Multiply";
+            case BlendMode::Screen: return "Screen";
+            case BlendMode::Overlay: return "Overlay";
+            case BlendMode::SoftLight: return "Soft Light";
+            case BlendMode::HardLight: return "Hard Light";
+            case BlendMode::ColorDodge: return "Color Dodge";
+            case BlendMode::ColorBurn: return "Color Burn";
+            case BlendMode::Darken: return "Darken";
+            case BlendMode::Lighten: return "Lighten";
+            case BlendMode::Difference: return "Difference";
+            case BlendMode::Exclusion: return "Exclusion";
+        }
+        return "Unknown";
+    }
+
+    const char* blendSpaceName(BlendSpace space)
+    {
+        switch (space) {
+            case BlendSpace::Srgb: return "sRGB";
+            case BlendSpace::Linear: return "Linear";
+        }
+        return "Unknown";
+    }
+
+} // namespace LibreEffects::Core
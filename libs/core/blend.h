@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include "cpufeatures.h"
+
+namespace LibreEffects::Core {
+
+    // Separable blend modes, in the same order as the applications' layer modes
+    enum class BlendMode {
+        Normal,
+        Multiply,
+        Screen,
+        Overlay,
+        SoftLight,
+        HardLight,
+        ColorDodge,
+        ColorBurn,
+        Darken,
+        Lighten,
+        Difference,
+        Exclusion
+    };
+
+    constexpr int BlendModeCount = 12;
+
+    // Premultiplied pixel layouts the kernels read and write
+    enum class PixelFormat {
+        ARGB32,     // 8-bit 0xAARRGGBB words, QImage::Format_ARGB32_Premultiplied
+        RGBA64,     // 16-bit R, G, B, A in memory, QImage::Format_RGBA64_Premultiplied
+        RGBA32F     // float R, G, B, A in memory, QImage::Format_RGBA32FPx4_Premultiplied
+    };
+
+    constexpr int PixelFormatCount = 3;
+
+    // Space the blend formulas are evaluated in. Pixels are always stored
+    // sRGB-encoded; Linear decodes source and destination through lookup
+    // tables, blends in linear light and encodes the result again, which
+    // avoids the dark fringes of soft edges and Multiply in encoded values.
+    enum class BlendSpace {
+        Srgb,
+        Linear
+    };
+
+    constexpr int BlendSpaceCount = 2;
+
+    int bytesPerPixel(PixelFormat format);
+
+    // Blends count source pixels over the destination row in place.
+    // Layer opacity is folded into the source before the blend. Formulas
+    // follow the W3C compositing spec, and all SIMD levels produce
+    // bit-identical results. Without a format, rows are ARGB32; without a
+    // space, blending happens on the encoded values.
+    using BlendRowFunction = void (*)(void* dst, const void* src, int count, float opacity);
+
+    BlendRowFunction blendRowFunction(BlendMode mode);
+    BlendRowFunction blendRowFunction(BlendMode mode, SimdLevel level);
+    BlendRowFunction blendRowFunction(PixelFormat format, BlendMode mode);
+    BlendRowFunction blendRowFunction(PixelFormat format, BlendMode mode, SimdLevel level);
+    BlendRowFunction blendRowFunction(PixelFormat format, BlendMode mode, BlendSpace space);
+    BlendRowFunction blendRowFunction(PixelFormat format, BlendMode mode, BlendSpace space, SimdLevel level);
+
+    inline void blendRow(BlendMode mode, uint32_t* dst, const uint32_t* src, int count, float opacity)
+    {
+        blendRowFunction(mode)(dst, src, count, opacity);
+    }
+
+    // Like BlendRowFunction, with an 8-bit coverage mask multiplied into the
+    // opacity per pixel: 0 hides the source pixel, 255 keeps it as is
+    using MaskedBlendRowFunction = void (*)(void* dst, const void* src, const uint8_t* mask,
+                                            int count, float opacity);
+
+    MaskedBlendRowFunction maskedBlendRowFunction(BlendMode mode);
+    MaskedBlendRowFunction maskedBlendRowFunction(BlendMode mode, SimdLevel level);
+    MaskedBlendRowFunction maskedBlendRowFunction(PixelFormat format, BlendMode mode);
+    MaskedBlendRowFunction maskedBlendRowFunction(PixelFormat format, BlendMode mode, SimdLevel level);
+    MaskedBlendRowFunction maskedBlendRowFunction(PixelFormat format, BlendMode mode, BlendSpace space);
+    MaskedBlendRowFunction maskedBlendRowFunction(PixelFormat format, BlendMode mode, BlendSpace space,
+                                                  SimdLevel level);
+
+    // Multiplies pixels in place by an 8-bit mask. Straight-alpha ARGB32
+    // pixels only have their alpha scaled; premultiplied pixels have every
+    // channel scaled.
+    using MaskRowFunction = void (*)(void* pixels, const uint8_t* mask, int count);
+
+    void maskAlphaRow(uint32_t* pixels, const uint8_t* mask, int count);
+    void maskPremultipliedRow(uint32_t* pixels, const uint8_t* mask, int count);
+    void maskPremultipliedRow(PixelFormat format, void* pixels, const uint8_t* mask, int count);
+
+    // Composites a brush dab source-over onto a row: color is one
+    // premultiplied R, G, B, A as dabColor returns it, scaled per pixel by
+    // an 8-bit stamp coverage and by opacity. Coverage, color and opacity
+    // are applied in the same pass, without an intermediate tinted stamp.
+    using DabRowFunction = void (*)(void* dst, const uint8_t* coverage, int count, const float* color,
+                                    float opacity);
+
+    // Converts a premultiplied R, G, B, A in [0, 1] into the space a dab is
+    // composited in, once per dab rather than once per row: decoded to
+    // linear light for BlendSpace::Linear, unchanged for sRGB
+    void dabColor(BlendSpace space, const float* color, float* out);
+
+    DabRowFunction dabRowFunction(PixelFormat format, BlendSpace space);
+    DabRowFunction dabRowFunction(PixelFormat format, BlendSpace space, SimdLevel level);
+
+    // Erases a dab from a row in place, destination-out: every premultiplied
+    // channel is scaled by 1 - coverage * opacity
+    using EraseRowFunction = void (*)(void* pixels, const uint8_t* coverage, int count, float opacity);
+
+    EraseRowFunction eraseRowFunction(PixelFormat format);
+    EraseRowFunction eraseRowFunction(PixelFormat format, SimdLevel level);
+
+    // Converts straight-alpha ARGB32 pixels to premultiplied
+    void premultiplyRow(uint32_t* dst, const uint32_t* src, int count);
+
+    const char* blendModeName(BlendMode mode);
+    const char* blendSpaceName(BlendSpace space);
+
+} // namespace LibreEffects::Core
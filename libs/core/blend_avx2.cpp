@@ -0,0 +1,177 @@
+// AVX2 blend kernels: eight pixels per iteration.
+// Compiled with AVX2 enabled and only reached through runtime dispatch.
+
+#include "blend_table.h"
+#include <immintrin.h>
+
+namespace LibreEffects::Core::Avx2 {
+
+    struct V {
+        __m256 v;
+
+        V() = default;
+        V(__m256 value) : v(value) {}
+        explicit V(float value) : v(_mm256_set1_ps(value)) {}
+    };
+
+    constexpr int Lanes = 8;
+    constexpr SimdLevel Narrower = SimdLevel::SSE41;
+
+    inline V operator+(V a, V b) { return _mm256_add_ps(a.v, b.v); }
+    inline V operator-(V a, V b) { return _mm256_sub_ps(a.v, b.v); }
+    inline V operator*(V a, V b) { return _mm256_mul_ps(a.v, b.v); }
+    inline V operator/(V a, V b) { return _mm256_div_ps(a.v, b.v); }
+    inline V vmin(V a, V b) { return _mm256_min_ps(a.v, b.v); }
+    inline V vmax(V a, V b) { return _mm256_max_ps(a.v, b.v); }
+    inline V vsqrt(V a) { return _mm256_sqrt_ps(a.v); }
+    inline V vfloor(V a) { return _mm256_floor_ps(a.v); }
+    inline V vle(V a, V b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+    inline V vge(V a, V b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+    inline V vselect(V mask, V a, V b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+    inline V vgather(const float* table, V index) { return _mm256_i32gather_ps(table, _mm256_cvttps_epi32(index.v), 4); }
+
+    inline void loadArgb32(const uint32_t* p, V& b, V& g, V& r, V& a)
+    {
+        const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const __m256i mask = _mm256_set1_epi32(0xff);
+        const __m256 scale = _mm256_set1_ps(1.0f / 255.0f);
+        b = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(pixels, mask)), scale);
+        g = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, 8), mask)), scale);
+        r = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, 16), mask)), scale);
+        a = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(pixels, 24)), scale);
+    }
+
+    inline __m256i toBytes(V value)
+    {
+        return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(value.v, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
+    }
+
+    inline void storeArgb32(uint32_t* p, V b, V g, V r, V a)
+    {
+        __m256i pixels = toBytes(b);
+        pixels = _mm256_or_si256(pixels, _mm256_slli_epi32(toBytes(g), 8));
+        pixels = _mm256_or_si256(pixels, _mm256_slli_epi32(toBytes(r), 16));
+        pixels = _mm256_or_si256(pixels, _mm256_slli_epi32(toBytes(a), 24));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), pixels);
+    }
+
+    inline bool isTransparentArgb32(const uint32_t* p)
+    {
+        const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        return _mm256_testz_si256(pixels, _mm256_set1_epi32(static_cast<int>(0xff000000u))) != 0;
+    }
+
+    // Wider formats are loaded with pixels k and k + 4 sharing a register
+    // and transposed within each 128-bit lane, which leaves every channel
+    // register in plain pixel order
+    inline void transposeLanes(__m256& a, __m256& b, __m256& c, __m256& d)
+    {
+        const __m256 t0 = _mm256_unpacklo_ps(a, b);
+        const __m256 t1 = _mm256_unpacklo_ps(c, d);
+        const __m256 t2 = _mm256_unpackhi_ps(a, b);
+        const __m256 t3 = _mm256_unpackhi_ps(c, d);
+        a = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+        b = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+        c = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        d = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    }
+
+    inline __m256 loadRgba64Pair(const Rgba64* p)
+    {
+        const __m128i low = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+        const __m128i high = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + 4)));
+        return _mm256_cvtepi32_ps(_mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1));
+    }
+
+    inline void loadRgba64(const Rgba64* p, V& r, V& g, V& b, V& a)
+    {
+        __m256 p0 = loadRgba64Pair(p);
+        __m256 p1 = loadRgba64Pair(p + 1);
+        __m256 p2 = loadRgba64Pair(p + 2);
+        __m256 p3 = loadRgba64Pair(p + 3);
+        transposeLanes(p0, p1, p2, p3);
+        const __m256 scale = _mm256_set1_ps(1.0f / 65535.0f);
+        r = _mm256_mul_ps(p0, scale);
+        g = _mm256_mul_ps(p1, scale);
+        b = _mm256_mul_ps(p2, scale);
+        a = _mm256_mul_ps(p3, scale);
+    }
+
+    inline void storeRgba64(Rgba64* p, V r, V g, V b, V a)
+    {
+        const __m256 scale = _mm256_set1_ps(65535.0f);
+        const __m256 half = _mm256_set1_ps(0.5f);
+        __m256 p0 = _mm256_add_ps(_mm256_mul_ps(r.v, scale), half);
+        __m256 p1 = _mm256_add_ps(_mm256_mul_ps(g.v, scale), half);
+        __m256 p2 = _mm256_add_ps(_mm256_mul_ps(b.v, scale), half);
+        __m256 p3 = _mm256_add_ps(_mm256_mul_ps(a.v, scale), half);
+        transposeLanes(p0, p1, p2, p3);
+        const __m256i i0 = _mm256_cvttps_epi32(p0);
+        const __m256i i1 = _mm256_cvttps_epi32(p1);
+        const __m256i i2 = _mm256_cvttps_epi32(p2);
+        const __m256i i3 = _mm256_cvttps_epi32(p3);
+        __m128i* out = reinterpret_cast<__m128i*>(p);
+        _mm_storeu_si128(out, _mm_packus_epi32(_mm256_castsi256_si128(i0), _mm256_castsi256_si128(i1)));
+        _mm_storeu_si128(out + 1, _mm_packus_epi32(_mm256_castsi256_si128(i2), _mm256_castsi256_si128(i3)));
+        _mm_storeu_si128(out + 2, _mm_packus_epi32(_mm256_extracti128_si256(i0, 1), _mm256_extracti128_si256(i1, 1)));
+        _mm_storeu_si128(out + 3, _mm_packus_epi32(_mm256_extracti128_si256(i2, 1), _mm256_extracti128_si256(i3, 1)));
+    }
+
+    inline bool isTransparentRgba64(const Rgba64* p)
+    {
+        const __m256i* words = reinterpret_cast<const __m256i*>(p);
+        const __m256i pixels = _mm256_or_si256(_mm256_loadu_si256(words), _mm256_loadu_si256(words + 1));
+        return _mm256_testz_si256(pixels, _mm256_set1_epi64x(static_cast<long long>(0xffff000000000000ull))) != 0;
+    }
+
+    inline __m256 loadRgbaF32Pair(const RgbaF32* p)
+    {
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&p[0].r)), _mm_loadu_ps(&p[4].r), 1);
+    }
+
+    inline void loadRgbaF32(const RgbaF32* p, V& r, V& g, V& b, V& a)
+    {
+        __m256 p0 = loadRgbaF32Pair(p);
+        __m256 p1 = loadRgbaF32Pair(p + 1);
+        __m256 p2 = loadRgbaF32Pair(p + 2);
+        __m256 p3 = loadRgbaF32Pair(p + 3);
+        transposeLanes(p0, p1, p2, p3);
+        r = p0;
+        g = p1;
+        b = p2;
+        a = p3;
+    }
+
+    inline void storeRgbaF32(RgbaF32* p, V r, V g, V b, V a)
+    {
+        transposeLanes(r.v, g.v, b.v, a.v);
+        const __m256 pixels[4] = { r.v, g.v, b.v, a.v };
+        for (int k = 0; k < 4; ++k) {
+            _mm_storeu_ps(&p[k].r, _mm256_castps256_ps128(pixels[k]));
+            _mm_storeu_ps(&p[k + 4].r, _mm256_extractf128_ps(pixels[k], 1));
+        }
+    }
+
+    inline bool isTransparentRgbaF32(const RgbaF32* p)
+    {
+        // Alpha is the top lane of each pixel; the sign bit is ignored so -0 counts
+        const __m256i* words = reinterpret_cast<const __m256i*>(p);
+        const __m256i pixels = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(words), _mm256_loadu_si256(words + 1)),
+                                               _mm256_or_si256(_mm256_loadu_si256(words + 2), _mm256_loadu_si256(words + 3)));
+        return _mm256_testz_si256(pixels, _mm256_set_epi32(0x7fffffff, 0, 0, 0, 0x7fffffff, 0, 0, 0)) != 0;
+    }
+
+    inline void loadMask8(const uint8_t* p, V& m)
+    {
+        const __m256i values = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+        m = _mm256_mul_ps(_mm256_cvtepi32_ps(values), _mm256_set1_ps(1.0f / 255.0f));
+    }
+
+#include "blend_kernels.h"
+
+    void fillKernelTable(KernelTable& table)
+    {
+        populateKernelTable(table);
+    }
+
+} // namespace LibreEffects::Core::Avx2
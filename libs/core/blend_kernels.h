@@ -0,0 +1,540 @@
+// Blend formulas shared by every instruction set level.
+//
+// This file is a code fragment, not a normal header: each kernel translation
+// unit includes it inside its own namespace after defining
+//   - a float vector type V with +, -, *, / and a broadcasting V(float)
+//   - vmin, vmax, vsqrt, vfloor, vselect(mask, a, b), vle, vge comparisons
+//   - vgather(table, index), reading table at each integral lane of index
+//   - Lanes, and Narrower, the level that dab and erase rows shorter than
+//     Lanes are handed to
+//   - for each pixel format (Argb32, Rgba64, RgbaF32) a load, store and
+//     isTransparent working on Lanes pixels at once
+//   - loadMask8, which widens Lanes mask bytes to normalized floats
+// Keeping the per-ISA code in separate namespaces stops the linker from
+// merging instantiations compiled for different instruction sets.
+
+// sa * da * B(Cb, Cs) of the W3C separable blend modes, rewritten on
+// premultiplied channels wherever that avoids a division
+template <BlendMode Mode>
+inline V blendTerm(V s, V sa, V d, V da)
+{
+    const V zero(0.0f);
+    const V one(1.0f);
+    const V two(2.0f);
+    const V epsilon(1.0f / 65536.0f);
+    const V sada = sa * da;
+
+    if constexpr (Mode == BlendMode::Multiply) {
+        return s * d;
+    } else if constexpr (Mode == BlendMode::Screen) {
+        return s * da + d * sa - s * d;
+    } else if constexpr (Mode == BlendMode::Overlay) {
+        return vselect(vle(two * d, da), two * s * d, sada - two * (da - d) * (sa - s));
+    } else if constexpr (Mode == BlendMode::HardLight) {
+        return vselect(vle(two * s, sa), two * s * d, sada - two * (da - d) * (sa - s));
+    } else if constexpr (Mode == BlendMode::SoftLight) {
+        const V cs = vmin(s / vmax(sa, epsilon), one);
+        const V cb = vmin(d / vmax(da, epsilon), one);
+        const V darker = cb - (one - two * cs) * cb * (one - cb);
+        const V curve = vselect(vle(cb, V(0.25f)), ((V(16.0f) * cb - V(12.0f)) * cb + V(4.0f)) * cb, vsqrt(cb));
+        const V lighter = cb + (two * cs - one) * (curve - cb);
+        return sada * vselect(vle(cs, V(0.5f)), darker, lighter);
+    } else if constexpr (Mode == BlendMode::ColorDodge) {
+        const V dodge = vmin(sada, sa * sa * d / vmax(sa - s, epsilon));
+        return vselect(vle(d, zero), zero, vselect(vge(s, sa), sada, dodge));
+    } else if constexpr (Mode == BlendMode::ColorBurn) {
+        const V burn = sada - vmin(sada, (da - d) * sa * sa / vmax(s, epsilon));
+        return vselect(vge(d, da), sada, vselect(vle(s, zero), zero, burn));
+    } else if constexpr (Mode == BlendMode::Darken) {
+        return vmin(s * da, d * sa);
+    } else if constexpr (Mode == BlendMode::Lighten) {
+        return vmax(s * da, d * sa);
+    } else if constexpr (Mode == BlendMode::Difference) {
+        const V a = s * da;
+        const V b = d * sa;
+        return vmax(a, b) - vmin(a, b);
+    } else if constexpr (Mode == BlendMode::Exclusion) {
+        return s * da + d * sa - two * s * d;
+    } else {
+        return s * da;
+    }
+}
+
+template <BlendMode Mode>
+inline V blendChannel(V s, V sa, V d, V da)
+{
+    const V one(1.0f);
+    if constexpr (Mode == BlendMode::Normal) {
+        return s + d * (one - sa);
+    } else {
+        return s * (one - da) + d * (one - sa) + blendTerm<Mode>(s, sa, d, da);
+    }
+}
+
+// Blends one vector of normalized premultiplied pixels into the destination
+template <BlendMode Mode>
+inline void blendPixels(V& db, V& dg, V& dr, V& da, V sb, V sg, V sr, V sa, V opacity)
+{
+    const V zero(0.0f);
+    const V one(1.0f);
+
+    sb = sb * opacity;
+    sg = sg * opacity;
+    sr = sr * opacity;
+    sa = sa * opacity;
+
+    const V ra = vmin(sa + da - sa * da, one);
+    const V rb = blendChannel<Mode>(sb, sa, db, da);
+    const V rg = blendChannel<Mode>(sg, sa, dg, da);
+    const V rr = blendChannel<Mode>(sr, sa, dr, da);
+
+    // Keep the result a valid premultiplied color
+    db = vmin(vmax(rb, zero), ra);
+    dg = vmin(vmax(rg, zero), ra);
+    dr = vmin(vmax(rr, zero), ra);
+    da = ra;
+}
+
+// Transfer tables a linear-light kernel reads, fetched once per row
+struct Transfer {
+    const float* toLinear;
+    const float* toSrgb;
+    const float* toLinear8;
+    const float* reciprocal8;
+    const float* toLinear16;
+    const float* toSrgb16;
+};
+
+template <BlendSpace Space>
+inline Transfer transferFor()
+{
+    if constexpr (Space == BlendSpace::Linear) {
+        return { srgbToLinearTable(), linearToSrgbTable(), srgbToLinear8Table(),
+                 reciprocal8Table(), srgbToLinear16Table(), linearToSrgb16Table() };
+    } else {
+        return {};
+    }
+}
+
+// Looks x up in a transfer table, clamped to [0, 1] and interpolated
+// between the two nearest entries
+inline V transferLookup(const float* table, V x)
+{
+    const V pos = vmin(vmax(x, V(0.0f)), V(1.0f)) * V(static_cast<float>(TransferTableSize - 1));
+    const V index = vmin(vfloor(pos), V(static_cast<float>(TransferTableSize - 2)));
+    const V low = vgather(table, index);
+    const V high = vgather(table + 1, index);
+    return low + (high - low) * (pos - index);
+}
+
+// Re-encodes premultiplied color through a transfer table. The curve
+// applies to straight color, so it is unpremultiplied around the lookup.
+inline void transferPixels(const float* table, V& r, V& g, V& b, V a)
+{
+    const V zero(0.0f);
+    const V unpremultiply = vselect(vle(a, zero), zero, V(1.0f) / vmax(a, V(1.0f / 65536.0f)));
+    r = transferLookup(table, r * unpremultiply) * a;
+    g = transferLookup(table, g * unpremultiply) * a;
+    b = transferLookup(table, b * unpremultiply) * a;
+}
+
+// Reads a direct table at x in [0, 1], rounded to the nearest sample
+inline V directLookup16(const float* table, V x)
+{
+    const V index = vfloor(vmin(vmax(x, V(0.0f)), V(1.0f)) * V(static_cast<float>(DirectTableSize - 1)) + V(0.5f));
+    return vgather(table, index);
+}
+
+// transferPixels through a direct 16-bit table, for 16-bit pixels
+inline void transferPixels16(const float* table, V& r, V& g, V& b, V a)
+{
+    const V zero(0.0f);
+    const V unpremultiply = vselect(vle(a, zero), zero, V(1.0f) / vmax(a, V(1.0f / 65536.0f)));
+    r = directLookup16(table, r * unpremultiply) * a;
+    g = directLookup16(table, g * unpremultiply) * a;
+    b = directLookup16(table, b * unpremultiply) * a;
+}
+
+// Decodes 8-bit premultiplied pixels. Unpremultiplying by the reciprocal
+// of the alpha byte lands each channel on the straight byte it encodes,
+// which indexes the curve directly.
+inline void decodePremultiplied8(const Transfer& transfer, V& r, V& g, V& b, V a)
+{
+    const V byteScale(255.0f);
+    const V half(0.5f);
+    const V one(1.0f);
+    const V unpremultiply = vgather(transfer.reciprocal8, vfloor(a * byteScale + half));
+    r = vgather(transfer.toLinear8, vfloor(vmin(r * unpremultiply, one) * byteScale + half)) * a;
+    g = vgather(transfer.toLinear8, vfloor(vmin(g * unpremultiply, one) * byteScale + half)) * a;
+    b = vgather(transfer.toLinear8, vfloor(vmin(b * unpremultiply, one) * byteScale + half)) * a;
+}
+
+// Encodes linear premultiplied pixels for 8-bit storage. Alpha is rounded
+// to the byte it is stored as first, so unpremultiplying is a lookup of
+// its reciprocal rather than a division.
+inline void encodePremultiplied8(const Transfer& transfer, V& r, V& g, V& b, V& a)
+{
+    const V alpha = vfloor(vmin(vmax(a, V(0.0f)), V(1.0f)) * V(255.0f) + V(0.5f));
+    const V unpremultiply = vgather(transfer.reciprocal8, alpha);
+    a = alpha * V(1.0f / 255.0f);
+    r = directLookup16(transfer.toSrgb16, r * unpremultiply) * a;
+    g = directLookup16(transfer.toSrgb16, g * unpremultiply) * a;
+    b = directLookup16(transfer.toSrgb16, b * unpremultiply) * a;
+}
+
+// Pixel layouts, each moving Lanes pixels to and from channel vectors and
+// between encoded and linear light, the fastest way their depth allows
+struct Argb32Layout {
+    static constexpr PixelFormat Format = PixelFormat::ARGB32;
+    using Pixel = uint32_t;
+    static void load(const Pixel* p, V& r, V& g, V& b, V& a) { loadArgb32(p, b, g, r, a); }
+    static void store(Pixel* p, V r, V g, V b, V a) { storeArgb32(p, b, g, r, a); }
+    static bool transparent(const Pixel* p) { return isTransparentArgb32(p); }
+    static void toLinear(const Transfer& t, V& r, V& g, V& b, V& a) { decodePremultiplied8(t, r, g, b, a); }
+    static void toSrgb(const Transfer& t, V& r, V& g, V& b, V& a) { encodePremultiplied8(t, r, g, b, a); }
+};
+
+struct Rgba64Layout {
+    static constexpr PixelFormat Format = PixelFormat::RGBA64;
+    using Pixel = Rgba64;
+    static void load(const Pixel* p, V& r, V& g, V& b, V& a) { loadRgba64(p, r, g, b, a); }
+    static void store(Pixel* p, V r, V g, V b, V a) { storeRgba64(p, r, g, b, a); }
+    static bool transparent(const Pixel* p) { return isTransparentRgba64(p); }
+    static void toLinear(const Transfer& t, V& r, V& g, V& b, V& a) { transferPixels16(t.toLinear16, r, g, b, a); }
+    static void toSrgb(const Transfer& t, V& r, V& g, V& b, V& a) { transferPixels16(t.toSrgb16, r, g, b, a); }
+};
+
+// Float pixels keep the interpolated curve; a nearest sample would cost
+// them precision they can store
+struct RgbaF32Layout {
+    static constexpr PixelFormat Format = PixelFormat::RGBA32F;
+    using Pixel = RgbaF32;
+    static void load(const Pixel* p, V& r, V& g, V& b, V& a) { loadRgbaF32(p, r, g, b, a); }
+    static void store(Pixel* p, V r, V g, V b, V a) { storeRgbaF32(p, r, g, b, a); }
+    static bool transparent(const Pixel* p) { return isTransparentRgbaF32(p); }
+    static void toLinear(const Transfer& t, V& r, V& g, V& b, V& a) { transferPixels(t.toLinear, r, g, b, a); }
+    static void toSrgb(const Transfer& t, V& r, V& g, V& b, V& a) { transferPixels(t.toSrgb, r, g, b, a); }
+};
+
+// Puts the original destination back in lanes whose source adds nothing.
+// Scalar code skips those pixels, while wider levels only skip whole
+// blocks, and neither the clamps nor the linear round trip are exact.
+template <typename Mask>
+inline void keepUntouched(Mask untouched, V& db, V& dg, V& dr, V& da, V ob, V og, V orr, V oa)
+{
+    db = vselect(untouched, ob, db);
+    dg = vselect(untouched, og, dg);
+    dr = vselect(untouched, orr, dr);
+    da = vselect(untouched, oa, da);
+}
+
+template <class Layout, BlendMode Mode, BlendSpace Space>
+inline void blendPixelsIn(const Transfer& transfer, V& db, V& dg, V& dr, V& da,
+                          V sb, V sg, V sr, V sa, V opacity)
+{
+    const auto untouched = vle(sa * opacity, V(0.0f));
+    const V ob = db, og = dg, orr = dr, oa = da;
+    if constexpr (Space == BlendSpace::Linear) {
+        Layout::toLinear(transfer, dr, dg, db, da);
+        Layout::toLinear(transfer, sr, sg, sb, sa);
+        blendPixels<Mode>(db, dg, dr, da, sb, sg, sr, sa, opacity);
+        Layout::toSrgb(transfer, dr, dg, db, da);
+    } else {
+        blendPixels<Mode>(db, dg, dr, da, sb, sg, sr, sa, opacity);
+    }
+    keepUntouched(untouched, db, dg, dr, da, ob, og, orr, oa);
+}
+
+template <class Layout, BlendMode Mode, BlendSpace Space>
+inline void blendBlock(typename Layout::Pixel* dst, const typename Layout::Pixel* src, V opacity,
+                       const Transfer& transfer)
+{
+    V dr, dg, db, da, sr, sg, sb, sa;
+    Layout::load(dst, dr, dg, db, da);
+    Layout::load(src, sr, sg, sb, sa);
+    blendPixelsIn<Layout, Mode, Space>(transfer, db, dg, dr, da, sb, sg, sr, sa, opacity);
+    Layout::store(dst, dr, dg, db, da);
+}
+
+template <class Layout, BlendMode Mode, BlendSpace Space>
+void blendRowImpl(void* dstRow, const void* srcRow, int count, float opacity)
+{
+    using Pixel = typename Layout::Pixel;
+    Pixel* dst = static_cast<Pixel*>(dstRow);
+    const Pixel* src = static_cast<const Pixel*>(srcRow);
+    const V op(opacity);
+    const Transfer transfer = transferFor<Space>();
+
+    int i = 0;
+    for (; i + Lanes <= count; i += Lanes) {
+        // A fully transparent source leaves the destination unchanged in every mode
+        if (Layout::transparent(src + i)) continue;
+        blendBlock<Layout, Mode, Space>(dst + i, src + i, op, transfer);
+    }
+
+    if (i < count) {
+        // Run the tail through a padded block so it takes the same code path
+        Pixel dstTail[Lanes] = {};
+        Pixel srcTail[Lanes] = {};
+        const int rest = count - i;
+        for (int k = 0; k < rest; ++k) {
+            dstTail[k] = dst[i + k];
+            srcTail[k] = src[i + k];
+        }
+        blendBlock<Layout, Mode, Space>(dstTail, srcTail, op, transfer);
+        for (int k = 0; k < rest; ++k) {
+            dst[i + k] = dstTail[k];
+        }
+    }
+}
+
+template <class Layout, BlendMode Mode, BlendSpace Space>
+inline void blendMaskedBlock(typename Layout::Pixel* dst, const typename Layout::Pixel* src, const uint8_t* mask, V opacity,
+                             const Transfer& transfer)
+{
+    V dr, dg, db, da, sr, sg, sb, sa, coverage;
+    Layout::load(dst, dr, dg, db, da);
+    Layout::load(src, sr, sg, sb, sa);
+    loadMask8(mask, coverage);
+    blendPixelsIn<Layout, Mode, Space>(transfer, db, dg, dr, da, sb, sg, sr, sa, opacity * coverage);
+    Layout::store(dst, dr, dg, db, da);
+}
+
+template <class Layout, BlendMode Mode, BlendSpace Space>
+void blendMaskedRowImpl(void* dstRow, const void* srcRow, const uint8_t* mask, int count, float opacity)
+{
+    using Pixel = typename Layout::Pixel;
+    Pixel* dst = static_cast<Pixel*>(dstRow);
+    const Pixel* src = static_cast<const Pixel*>(srcRow);
+    const V op(opacity);
+    const Transfer transfer = transferFor<Space>();
+
+    int i = 0;
+    for (; i + Lanes <= count; i += Lanes) {
+        if (Layout::transparent(src + i)) continue;
+        blendMaskedBlock<Layout, Mode, Space>(dst + i, src + i, mask + i, op, transfer);
+    }
+
+    if (i < count) {
+        Pixel dstTail[Lanes] = {};
+        Pixel srcTail[Lanes] = {};
+        uint8_t maskTail[Lanes] = {};
+        const int rest = count - i;
+        for (int k = 0; k < rest; ++k) {
+            dstTail[k] = dst[i + k];
+            srcTail[k] = src[i + k];
+            maskTail[k] = mask[i + k];
+        }
+        blendMaskedBlock<Layout, Mode, Space>(dstTail, srcTail, maskTail, op, transfer);
+        for (int k = 0; k < rest; ++k) {
+            dst[i + k] = dstTail[k];
+        }
+    }
+}
+
+template <class Layout, bool Premultiplied>
+inline void maskBlock(typename Layout::Pixel* pixels, const uint8_t* mask)
+{
+    V r, g, b, a, coverage;
+    Layout::load(pixels, r, g, b, a);
+    loadMask8(mask, coverage);
+    if constexpr (Premultiplied) {
+        r = r * coverage;
+        g = g * coverage;
+        b = b * coverage;
+    }
+    a = a * coverage;
+    Layout::store(pixels, r, g, b, a);
+}
+
+template <class Layout, bool Premultiplied>
+void maskRowImpl(void* row, const uint8_t* mask, int count)
+{
+    using Pixel = typename Layout::Pixel;
+    Pixel* pixels = static_cast<Pixel*>(row);
+
+    int i = 0;
+    for (; i + Lanes <= count; i += Lanes) {
+        maskBlock<Layout, Premultiplied>(pixels + i, mask + i);
+    }
+
+    if (i < count) {
+        Pixel pixelTail[Lanes] = {};
+        uint8_t maskTail[Lanes] = {};
+        const int rest = count - i;
+        for (int k = 0; k < rest; ++k) {
+            pixelTail[k] = pixels[i + k];
+            maskTail[k] = mask[i + k];
+        }
+        maskBlock<Layout, Premultiplied>(pixelTail, maskTail);
+        for (int k = 0; k < rest; ++k) {
+            pixels[i + k] = pixelTail[k];
+        }
+    }
+}
+
+// True when none of the count coverage bytes would paint anything
+inline bool coverageEmpty(const uint8_t* coverage, int count = Lanes)
+{
+    for (int k = 0; k < count; ++k) {
+        if (coverage[k]) return false;
+    }
+    return true;
+}
+
+// Brush dab: one premultiplied color, scaled per pixel by the stamp's
+// coverage and the dab opacity, composited source-over. In linear light
+// the color arrives already decoded by dabColor, so only the destination
+// goes through the transfer tables here.
+template <class Layout, BlendSpace Space>
+inline void dabBlock(typename Layout::Pixel* dst, const uint8_t* coverage, V cr, V cg, V cb, V ca, V opacity,
+                     const Transfer& transfer)
+{
+    V dr, dg, db, da, c;
+    Layout::load(dst, dr, dg, db, da);
+    loadMask8(coverage, c);
+    const V strength = opacity * c;
+    const auto untouched = vle(ca * strength, V(0.0f));
+    const V ob = db, og = dg, orr = dr, oa = da;
+    if constexpr (Space == BlendSpace::Linear) {
+        Layout::toLinear(transfer, dr, dg, db, da);
+        blendPixels<BlendMode::Normal>(db, dg, dr, da, cb, cg, cr, ca, strength);
+        Layout::toSrgb(transfer, dr, dg, db, da);
+    } else {
+        blendPixels<BlendMode::Normal>(db, dg, dr, da, cb, cg, cr, ca, strength);
+    }
+    keepUntouched(untouched, db, dg, dr, da, ob, og, orr, oa);
+    Layout::store(dst, dr, dg, db, da);
+}
+
+// Row kernels of the Narrower level. Small dabs are mostly rows and tails
+// shorter than Lanes, which it paints with the same result for less than a
+// padded block costs.
+template <class Layout, BlendSpace Space>
+inline DabRowFunction narrowerDabRow()
+{
+    static const DabRowFunction row =
+        kernelTable(Narrower).formats[static_cast<int>(Layout::Format)].dab[static_cast<int>(Space)];
+    return row;
+}
+
+template <class Layout>
+inline EraseRowFunction narrowerEraseRow()
+{
+    static const EraseRowFunction row = kernelTable(Narrower).formats[static_cast<int>(Layout::Format)].erase;
+    return row;
+}
+
+template <class Layout, BlendSpace Space>
+void dabRowImpl(void* dstRow, const uint8_t* coverage, int count, const float* color, float opacity)
+{
+    if constexpr (Lanes > 1) {
+        // Stamp edges are often empty, and skipping them here saves a call
+        if (count < Lanes) {
+            if (coverageEmpty(coverage, count)) return;
+            narrowerDabRow<Layout, Space>()(dstRow, coverage, count, color, opacity);
+            return;
+        }
+    }
+
+    using Pixel = typename Layout::Pixel;
+    Pixel* dst = static_cast<Pixel*>(dstRow);
+    const V op(opacity);
+    static const Transfer transfer = transferFor<Space>();
+    const V cr(color[0]), cg(color[1]), cb(color[2]), ca(color[3]);
+
+    int i = 0;
+    for (; i + Lanes <= count; i += Lanes) {
+        // Stamps are mostly empty around the round footprint
+        if (coverageEmpty(coverage + i)) continue;
+        dabBlock<Layout, Space>(dst + i, coverage + i, cr, cg, cb, ca, op, transfer);
+    }
+
+    if constexpr (Lanes > 1) {
+        if (i < count && !coverageEmpty(coverage + i, count - i)) {
+            narrowerDabRow<Layout, Space>()(dst + i, coverage + i, count - i, color, opacity);
+        }
+    }
+}
+
+// Eraser dab: destination-out, scaling every premultiplied channel by one
+// minus coverage times opacity. Straight color is unchanged, so the result
+// is the same in either blend space.
+template <class Layout>
+inline void eraseBlock(typename Layout::Pixel* pixels, const uint8_t* coverage, V opacity)
+{
+    V r, g, b, a, c;
+    Layout::load(pixels, r, g, b, a);
+    loadMask8(coverage, c);
+    // Transparent pixels are left as they are, as the scalar skip does
+    const V keep = vselect(vle(a, V(0.0f)), V(1.0f), V(1.0f) - opacity * c);
+    Layout::store(pixels, r * keep, g * keep, b * keep, a * keep);
+}
+
+template <class Layout>
+void eraseRowImpl(void* row, const uint8_t* coverage, int count, float opacity)
+{
+    if constexpr (Lanes > 1) {
+        if (count < Lanes) {
+            if (coverageEmpty(coverage, count)) return;
+            narrowerEraseRow<Layout>()(row, coverage, count, opacity);
+            return;
+        }
+    }
+
+    using Pixel = typename Layout::Pixel;
+    Pixel* pixels = static_cast<Pixel*>(row);
+    const V op(opacity);
+
+    int i = 0;
+    for (; i + Lanes <= count; i += Lanes) {
+        if (coverageEmpty(coverage + i) || Layout::transparent(pixels + i)) continue;
+        eraseBlock<Layout>(pixels + i, coverage + i, op);
+    }
+
+    if constexpr (Lanes > 1) {
+        if (i < count && !coverageEmpty(coverage + i, count - i)) {
+            narrowerEraseRow<Layout>()(pixels + i, coverage + i, count - i, opacity);
+        }
+    }
+}
+
+template <class Layout, BlendMode Mode>
+inline void setModeKernels(FormatKernels& kernels)
+{
+    constexpr int srgb = static_cast<int>(BlendSpace::Srgb);
+    constexpr int linear = static_cast<int>(BlendSpace::Linear);
+    kernels.blend[srgb][static_cast<int>(Mode)] = &blendRowImpl<Layout, Mode, BlendSpace::Srgb>;
+    kernels.blend[linear][static_cast<int>(Mode)] = &blendRowImpl<Layout, Mode, BlendSpace::Linear>;
+    kernels.maskedBlend[srgb][static_cast<int>(Mode)] = &blendMaskedRowImpl<Layout, Mode, BlendSpace::Srgb>;
+    kernels.maskedBlend[linear][static_cast<int>(Mode)] = &blendMaskedRowImpl<Layout, Mode, BlendSpace::Linear>;
+}
+
+template <class Layout>
+inline void populateFormatKernels(FormatKernels& kernels)
+{
+    setModeKernels<Layout, BlendMode::Normal>(kernels);
+    setModeKernels<Layout, BlendMode::Multiply>(kernels);
+    setModeKernels<Layout, BlendMode::Screen>(kernels);
+    setModeKernels<Layout, BlendMode::Overlay>(kernels);
+    setModeKernels<Layout, BlendMode::SoftLight>(kernels);
+    setModeKernels<Layout, BlendMode::HardLight>(kernels);
+    setModeKernels<Layout, BlendMode::ColorDodge>(kernels);
+    setModeKernels<Layout, BlendMode::ColorBurn>(kernels);
+    setModeKernels<Layout, BlendMode::Darken>(kernels);
+    setModeKernels<Layout, BlendMode::Lighten>(kernels);
+    setModeKernels<Layout, BlendMode::Difference>(kernels);
+    setModeKernels<Layout, BlendMode::Exclusion>(kernels);
+    kernels.maskPremultiplied = &maskRowImpl<Layout, true>;
+    kernels.dab[static_cast<int>(BlendSpace::Srgb)] = &dabRowImpl<Layout, BlendSpace::Srgb>;
+    kernels.dab[static_cast<int>(BlendSpace::Linear)] = &dabRowImpl<Layout, BlendSpace::Linear>;
+    kernels.erase = &eraseRowImpl<Layout>;
+}
+
+inline void populateKernelTable(KernelTable& table)
+{
+    populateFormatKernels<Argb32Layout>(table.formats[static_cast<int>(PixelFormat::ARGB32)]);
+    populateFormatKernels<Rgba64Layout>(table.formats[static_cast<int>(PixelFormat::RGBA64)]);
+    populateFormatKernels<RgbaF32Layout>(table.formats[static_cast<int>(PixelFormat::RGBA32F)]);
+    table.maskAlpha = &maskRowImpl<Argb32Layout, false>;
+}
@@ -0,0 +1,158 @@
+// SSE4.1 blend kernels: four pixels per iteration.
+// Compiled with SSE4.1 enabled and only reached through runtime dispatch.
+
+#include "blend_table.h"
+#include <smmintrin.h>
+#include <cstring>
+
+namespace LibreEffects::Core::Sse41 {
+
+    struct V {
+        __m128 v;
+
+        V() = default;
+        V(__m128 value) : v(value) {}
+        explicit V(float value) : v(_mm_set1_ps(value)) {}
+    };
+
+    constexpr int Lanes = 4;
+    constexpr SimdLevel Narrower = SimdLevel::Scalar;
+
+    inline V operator+(V a, V b) { return _mm_add_ps(a.v, b.v); }
+    inline V operator-(V a, V b) { return _mm_sub_ps(a.v, b.v); }
+    inline V operator*(V a, V b) { return _mm_mul_ps(a.v, b.v); }
+    inline V operator/(V a, V b) { return _mm_div_ps(a.v, b.v); }
+    inline V vmin(V a, V b) { return _mm_min_ps(a.v, b.v); }
+    inline V vmax(V a, V b) { return _mm_max_ps(a.v, b.v); }
+    inline V vsqrt(V a) { return _mm_sqrt_ps(a.v); }
+    inline V vfloor(V a) { return _mm_floor_ps(a.v); }
+    inline V vle(V a, V b) { return _mm_cmple_ps(a.v, b.v); }
+    inline V vge(V a, V b) { return _mm_cmpge_ps(a.v, b.v); }
+    inline V vselect(V mask, V a, V b) { return _mm_blendv_ps(b.v, a.v, mask.v); }
+
+    // No gather before AVX2; the indices go through memory instead
+    inline V vgather(const float* table, V index)
+    {
+        alignas(16) int32_t indices[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(indices), _mm_cvttps_epi32(index.v));
+        return _mm_setr_ps(table[indices[0]], table[indices[1]], table[indices[2]], table[indices[3]]);
+    }
+
+    inline void loadArgb32(const uint32_t* p, V& b, V& g, V& r, V& a)
+    {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i mask = _mm_set1_epi32(0xff);
+        const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+        b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(pixels, mask)), scale);
+        g = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 8), mask)), scale);
+        r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 16), mask)), scale);
+        a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(pixels, 24)), scale);
+    }
+
+    inline __m128i toBytes(V value)
+    {
+        return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value.v, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+    }
+
+    inline void storeArgb32(uint32_t* p, V b, V g, V r, V a)
+    {
+        __m128i pixels = toBytes(b);
+        pixels = _mm_or_si128(pixels, _mm_slli_epi32(toBytes(g), 8));
+        pixels = _mm_or_si128(pixels, _mm_slli_epi32(toBytes(r), 16));
+        pixels = _mm_or_si128(pixels, _mm_slli_epi32(toBytes(a), 24));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), pixels);
+    }
+
+    inline bool isTransparentArgb32(const uint32_t* p)
+    {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        return _mm_testz_si128(pixels, _mm_set1_epi32(static_cast<int>(0xff000000u))) != 0;
+    }
+
+    // Wider formats hold one pixel per register after loading, so they are
+    // transposed into one register per channel
+    inline void loadRgba64(const Rgba64* p, V& r, V& g, V& b, V& a)
+    {
+        const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2));
+        __m128 p0 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(first));
+        __m128 p1 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(first, 8)));
+        __m128 p2 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(second));
+        __m128 p3 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(second, 8)));
+        _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+        const __m128 scale = _mm_set1_ps(1.0f / 65535.0f);
+        r = _mm_mul_ps(p0, scale);
+        g = _mm_mul_ps(p1, scale);
+        b = _mm_mul_ps(p2, scale);
+        a = _mm_mul_ps(p3, scale);
+    }
+
+    inline void storeRgba64(Rgba64* p, V r, V g, V b, V a)
+    {
+        const __m128 scale = _mm_set1_ps(65535.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        __m128 p0 = _mm_add_ps(_mm_mul_ps(r.v, scale), half);
+        __m128 p1 = _mm_add_ps(_mm_mul_ps(g.v, scale), half);
+        __m128 p2 = _mm_add_ps(_mm_mul_ps(b.v, scale), half);
+        __m128 p3 = _mm_add_ps(_mm_mul_ps(a.v, scale), half);
+        _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+        const __m128i first = _mm_packus_epi32(_mm_cvttps_epi32(p0), _mm_cvttps_epi32(p1));
+        const __m128i second = _mm_packus_epi32(_mm_cvttps_epi32(p2), _mm_cvttps_epi32(p3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), first);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 2), second);
+    }
+
+    inline bool isTransparentRgba64(const Rgba64* p)
+    {
+        const __m128i pixels = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)),
+                                            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2)));
+        return _mm_testz_si128(pixels, _mm_set1_epi64x(static_cast<long long>(0xffff000000000000ull))) != 0;
+    }
+
+    inline void loadRgbaF32(const RgbaF32* p, V& r, V& g, V& b, V& a)
+    {
+        __m128 p0 = _mm_loadu_ps(&p[0].r);
+        __m128 p1 = _mm_loadu_ps(&p[1].r);
+        __m128 p2 = _mm_loadu_ps(&p[2].r);
+        __m128 p3 = _mm_loadu_ps(&p[3].r);
+        _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+        r = p0;
+        g = p1;
+        b = p2;
+        a = p3;
+    }
+
+    inline void storeRgbaF32(RgbaF32* p, V r, V g, V b, V a)
+    {
+        _MM_TRANSPOSE4_PS(r.v, g.v, b.v, a.v);
+        _mm_storeu_ps(&p[0].r, r.v);
+        _mm_storeu_ps(&p[1].r, g.v);
+        _mm_storeu_ps(&p[2].r, b.v);
+        _mm_storeu_ps(&p[3].r, a.v);
+    }
+
+    inline bool isTransparentRgbaF32(const RgbaF32* p)
+    {
+        // Alpha is the top lane of each pixel; the sign bit is ignored so -0 counts
+        const __m128i* words = reinterpret_cast<const __m128i*>(p);
+        const __m128i pixels = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(words), _mm_loadu_si128(words + 1)),
+                                            _mm_or_si128(_mm_loadu_si128(words + 2), _mm_loadu_si128(words + 3)));
+        return _mm_testz_si128(pixels, _mm_set_epi32(0x7fffffff, 0, 0, 0)) != 0;
+    }
+
+    inline void loadMask8(const uint8_t* p, V& m)
+    {
+        int bytes;
+        std::memcpy(&bytes, p, sizeof(bytes));
+        const __m128i values = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+        m = _mm_mul_ps(_mm_cvtepi32_ps(values), _mm_set1_ps(1.0f / 255.0f));
+    }
+
+#include "blend_kernels.h"
+
+    void fillKernelTable(KernelTable& table)
+    {
+        populateKernelTable(table);
+    }
+
+} // namespace LibreEffects::Core::Sse41
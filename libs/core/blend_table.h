@@ -0,0 +1,37 @@
+#pragma once
+
+#include "blend.h"
+#include "transfer.h"
+
+namespace LibreEffects::Core {
+
+    // RGBA64 and RGBA32F pixels as laid out in memory
+    struct Rgba64 {
+        uint16_t r, g, b, a;
+    };
+
+    struct RgbaF32 {
+        float r, g, b, a;
+    };
+
+    // Kernels provided by one instruction set level for one pixel format
+    struct FormatKernels {
+        BlendRowFunction blend[BlendSpaceCount][BlendModeCount] = {};
+        MaskedBlendRowFunction maskedBlend[BlendSpaceCount][BlendModeCount] = {};
+        MaskRowFunction maskPremultiplied = nullptr;
+        DabRowFunction dab[BlendSpaceCount] = {};
+        EraseRowFunction erase = nullptr;
+    };
+
+    // Everything one instruction set level provides. Each kernel translation
+    // unit fills one of these from blend_kernels.h.
+    struct KernelTable {
+        FormatKernels formats[PixelFormatCount];
+        MaskRowFunction maskAlpha = nullptr;
+    };
+
+    // The kernels of a level, capped at what the CPU supports. Wider levels
+    // also use it to hand row tails to a narrower one.
+    const KernelTable& kernelTable(SimdLevel level);
+
+} // namespace LibreEffects::Core
@@ -0,0 +1,85 @@
+#include "cpufeatures.h"
+#include <atomic>
+
+#if defined(LIBREEFFECTS_CORE_X86_SIMD) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace LibreEffects::Core {
+
+    namespace {
+
+        SimdLevel queryCpu()
+        {
+#if defined(LIBREEFFECTS_CORE_X86_SIMD) && defined(_MSC_VER)
+            int info[4] = {};
+            __cpuid(info, 0);
+            const int maxLeaf = info[0];
+
+            __cpuid(info, 1);
+            const bool sse41 = (info[2] & (1 << 19)) != 0;
+            const bool osxsave = (info[2] & (1 << 27)) != 0;
+            const bool avx = (info[2] & (1 << 28)) != 0;
+
+            bool avx2 = false;
+            if (maxLeaf >= 7 && osxsave && avx) {
+                // The OS must save the YMM registers across context switches
+                const unsigned long long xcr0 = _xgetbv(0);
+                if ((xcr0 & 0x6) == 0x6) {
+                    __cpuidex(info, 7, 0);
+                    avx2 = (info[1] & (1 << 5)) != 0;
+                }
+            }
+
+            if (avx2) return SimdLevel::AVX2;
+            if (sse41) return SimdLevel::SSE41;
+            return SimdLevel::Scalar;
+#elif defined(LIBREEFFECTS_CORE_X86_SIMD) && (defined(__GNUC__) || defined(__clang__))
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+            if (__builtin_cpu_supports("sse4.1")) return SimdLevel::SSE41;
+            return SimdLevel::Scalar;
+#else
+            return SimdLevel::Scalar;
+#endif
+        }
+
+        std::atomic<int>& activeLevelStorage()
+        {
+            static std::atomic<int> level(static_cast<int>(detectSimdLevel()));
+            return level;
+        }
+
+    } // namespace
+
+    SimdLevel detectSimdLevel()
+    {
+        static const SimdLevel level = queryCpu();
+        return level;
+    }
+
+    SimdLevel activeSimdLevel()
+    {
+        return static_cast<SimdLevel>(activeLevelStorage().load(std::memory_order_relaxed));
+    }
+
+    void setActiveSimdLevel(SimdLevel level)
+    {
+        if (static_cast<int>(level) > static_cast<int>(detectSimdLevel())) {
+            level = detectSimdLevel();
+        }
+        activeLevelStorage().store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+
+    const char* simdLevelName(SimdLevel level)
+    {
+        switch (level) {
+            case SimdLevel::Scalar: return "Scalar";
+            case SimdLevel::SSE41: return "SSE4.1";
+            case SimdLevel::AVX2: return "AVX2";
+        }
+        return "Unknown";
+    }
+
+} // namespace LibreEffects::Core
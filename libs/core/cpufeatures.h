@@ -0,0 +1,23 @@
+#pragma once
+
+namespace LibreEffects::Core {
+
+    // Instruction set levels the pixel kernels are compiled for
+    enum class SimdLevel {
+        Scalar,
+        SSE41,
+        AVX2
+    };
+
+    // Highest level supported by both the CPU and this build
+    SimdLevel detectSimdLevel();
+
+    // Level the kernels currently dispatch to. Defaults to detectSimdLevel();
+    // it can be lowered (never raised past what the CPU supports) to compare
+    // implementations.
+    SimdLevel activeSimdLevel();
+    void setActiveSimdLevel(SimdLevel level);
+
+    const char* simdLevelName(SimdLevel level);
+
+} // namespace LibreEffects::Core
@@ -0,0 +1,79 @@
+#include "downsample.h"
+#include "blend_table.h"
+
+namespace LibreEffects::Core {
+
+    // Averages four pixels two channels at a time; each 16-bit field holds
+    // at most 4 * 255 so nothing spills into its neighbour
+    static inline uint32_t average4(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+    {
+        const uint32_t low = (a & 0xff00ff) + (b & 0xff00ff) + (c & 0xff00ff) + (d & 0xff00ff);
+        const uint32_t high = ((a >> 8) & 0xff00ff) + ((b >> 8) & 0xff00ff)
+                            + ((c >> 8) & 0xff00ff) + ((d >> 8) & 0xff00ff);
+        return (((low + 0x20002) >> 2) & 0xff00ff) | ((((high + 0x20002) >> 2) & 0xff00ff) << 8);
+    }
+
+    static inline Rgba64 average4(const Rgba64& a, const Rgba64& b, const Rgba64& c, const Rgba64& d)
+    {
+        auto channel = [](int p, int q, int r, int s) { return static_cast<uint16_t>((p + q + r + s + 2) >> 2); };
+        return { channel(a.r, b.r, c.r, d.r), channel(a.g, b.g, c.g, d.g),
+                 channel(a.b, b.b, c.b, d.b), channel(a.a, b.a, c.a, d.a) };
+    }
+
+    static inline RgbaF32 average4(const RgbaF32& a, const RgbaF32& b, const RgbaF32& c, const RgbaF32& d)
+    {
+        return { (a.r + b.r + c.r + d.r) * 0.25f, (a.g + b.g + c.g + d.g) * 0.25f,
+                 (a.b + b.b + c.b + d.b) * 0.25f, (a.a + b.a + c.a + d.a) * 0.25f };
+    }
+
+    template <typename Pixel>
+    static void downsampleImpl(Pixel* dst, int dstStride, const Pixel* src, int srcStride,
+                               int srcWidth, int srcHeight, int x, int y, int width, int height)
+    {
+        for (int row = 0; row < height; ++row) {
+            const int sy = 2 * (y + row);
+            const Pixel* top = src + static_cast<long long>(sy) * srcStride;
+            const Pixel* bottom = sy + 1 < srcHeight ? top + srcStride : top;
+            Pixel* out = dst + static_cast<long long>(row) * dstStride;
+
+            // Pairs fully inside the source need no clamping
+            const int full = srcWidth / 2 - x < width ? srcWidth / 2 - x : width;
+            int column = 0;
+            for (; column < full; ++column) {
+                const int sx = 2 * (x + column);
+                out[column] = average4(top[sx], top[sx + 1], bottom[sx], bottom[sx + 1]);
+            }
+            for (; column < width; ++column) {
+                const int sx = 2 * (x + column);
+                const int sx1 = sx + 1 < srcWidth ? sx + 1 : sx;
+                out[column] = average4(top[sx], top[sx1], bottom[sx], bottom[sx1]);
+            }
+        }
+    }
+
+    void downsample2x(uint32_t* dst, int dstStride, const uint32_t* src, int srcStride,
+                      int srcWidth, int srcHeight, int x, int y, int width, int height)
+    {
+        downsampleImpl(dst, dstStride, src, srcStride, srcWidth, srcHeight, x, y, width, height);
+    }
+
+    void downsample2x(PixelFormat format, void* dst, int dstStride, const void* src, int srcStride,
+                      int srcWidth, int srcHeight, int x, int y, int width, int height)
+    {
+        switch (format) {
+            case PixelFormat::ARGB32:
+                downsampleImpl(static_cast<uint32_t*>(dst), dstStride, static_cast<const uint32_t*>(src), srcStride,
+                               srcWidth, srcHeight, x, y, width, height);
+                break;
+            case PixelFormat::RGBA64:
+                downsampleImpl(static_cast<Rgba64*>(dst), dstStride, static_cast<const Rgba64*>(src), srcStride,
+                               srcWidth, srcHeight, x, y, width, height);
+                break;
+            case PixelFormat::RGBA32F:
+                downsampleImpl(static_cast<RgbaF32*>(dst), dstStride, static_cast<const RgbaF32*>(src), srcStride,
+                               srcWidth, srcHeight, x, y, width, height);
+                break;
+        }
+    }
+
+} // namespace LibreEffects::Core
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include "blend.h"
+
+namespace LibreEffects::Core {
+
+    // Halves an area of a 32-bit ARGB image with a 2x2 box filter, rounding
+    // to nearest. Works on premultiplied pixels, which is what keeps edges of
+    // transparent areas from darkening.
+    //
+    // dst points at pixel (x, y) of the half-size image and receives width x
+    // height pixels; each one averages source pixels (2x..2x+1, 2y..2y+1).
+    // Reads past the last source column or row repeat the edge pixel, so odd
+    // sizes round up. Strides are in pixels.
+    void downsample2x(uint32_t* dst, int dstStride, const uint32_t* src, int srcStride,
+                      int srcWidth, int srcHeight, int x, int y, int width, int height);
+
+    // The same for any premultiplied pixel format
+    void downsample2x(PixelFormat format, void* dst, int dstStride, const void* src, int srcStride,
+                      int srcWidth, int srcHeight, int x, int y, int width, int height);
+
+} // namespace LibreEffects::Core
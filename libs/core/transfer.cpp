@@ -0,0 +1,98 @@
+#include "transfer.h"
+#include <cmath>
+
+namespace LibreEffects::Core {
+
+    namespace {
+
+        struct TransferTables {
+            float toLinear[TransferTableSize];
+            float toSrgb[TransferTableSize];
+
+            TransferTables()
+            {
+                for (int i = 0; i < TransferTableSize; ++i) {
+                    const float x = static_cast<float>(i) / (TransferTableSize - 1);
+                    toLinear[i] = srgbToLinear(x);
+                    toSrgb[i] = linearToSrgb(x);
+                }
+            }
+        };
+
+        const TransferTables& transferTables()
+        {
+            static const TransferTables tables;
+            return tables;
+        }
+
+        struct DirectTables {
+            float toLinear8[256];
+            float reciprocal8[256];
+            float toLinear16[DirectTableSize];
+            float toSrgb16[DirectTableSize];
+
+            DirectTables()
+            {
+                for (int alpha = 0; alpha < 256; ++alpha) {
+                    reciprocal8[alpha] = alpha ? 255.0f / alpha : 0.0f;
+                    toLinear8[alpha] = srgbToLinear(alpha / 255.0f);
+                }
+                for (int i = 0; i < DirectTableSize; ++i) {
+                    const float x = static_cast<float>(i) / (DirectTableSize - 1);
+                    toLinear16[i] = srgbToLinear(x);
+                    toSrgb16[i] = linearToSrgb(x);
+                }
+            }
+        };
+
+        const DirectTables& directTables()
+        {
+            static const DirectTables tables;
+            return tables;
+        }
+
+    } // namespace
+
+    float srgbToLinear(float value)
+    {
+        if (value <= 0.04045f) return value / 12.92f;
+        return static_cast<float>(std::pow((value + 0.055) / 1.055, 2.4));
+    }
+
+    float linearToSrgb(float value)
+    {
+        if (value <= 0.0031308f) return value * 12.92f;
+        return static_cast<float>(1.055 * std::pow(static_cast<double>(value), 1.0 / 2.4) - 0.055);
+    }
+
+    const float* srgbToLinearTable()
+    {
+        return transferTables().toLinear;
+    }
+
+    const float* linearToSrgbTable()
+    {
+        return transferTables().toSrgb;
+    }
+
+    const float* srgbToLinear8Table()
+    {
+        return directTables().toLinear8;
+    }
+
+    const float* reciprocal8Table()
+    {
+        return directTables().reciprocal8;
+    }
+
+    const float* srgbToLinear16Table()
+    {
+        return directTables().toLinear16;
+    }
+
+    const float* linearToSrgb16Table()
+    {
+        return directTables().toSrgb16;
+    }
+
+} // namespace LibreEffects::Core
@@ -0,0 +1,30 @@
+#pragma once
+
+namespace LibreEffects::Core {
+
+    // The sRGB transfer curve, sampled into tables for blending in linear
+    // light. Each table holds TransferTableSize evenly spaced samples over
+    // [0, 1]; lookups interpolate linearly between neighbours, which stays
+    // within about 2e-5 of the exact curve.
+    constexpr int TransferTableSize = 4096;
+
+    const float* srgbToLinearTable();
+    const float* linearToSrgbTable();
+
+    // Direct tables for the integer formats, read without interpolation.
+    // The 8-bit tables are indexed by a byte: the sRGB curve per straight
+    // channel byte, and 1 / (alpha / 255) per alpha byte, 0 for alpha 0.
+    // The 16-bit tables hold DirectTableSize samples of each curve; the
+    // linear to sRGB one also serves 8-bit results, well within rounding.
+    constexpr int DirectTableSize = 65536;
+
+    const float* srgbToLinear8Table();
+    const float* reciprocal8Table();
+    const float* srgbToLinear16Table();
+    const float* linearToSrgb16Table();
+
+    // Exact curves the tables are built from
+    float srgbToLinear(float value);
+    float linearToSrgb(float value);
+
+} // namespace LibreEffects::Core
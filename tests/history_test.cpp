@@ -0,0 +1,103 @@
+#include <QtTest>
+#include "document.h"
+#include "history.h"
+
+using namespace LibreCanvas;
+
+class HistoryTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void undoesPagedOutStrokes();
+    void foldsStrokesIntoOldestSnapshot();
+
+private:
+    static constexpr int Strokes = 10;
+
+    // One stroke per tile, each in its own color, recorded as a tile edit
+    static void paintStrokes(Document& document);
+    static QPoint strokePoint(int stroke);
+    static QColor strokeColor(int stroke);
+};
+
+void HistoryTest::paintStrokes(Document& document)
+{
+    auto layer = document.getActiveLayer();
+    for (int stroke = 0; stroke < Strokes; ++stroke) {
+        document.beginEdit();
+        layer->paint(QRect(strokePoint(stroke), QSize(32, 32)), [&](QPainter& painter) {
+            painter.fillRect(QRect(strokePoint(stroke), QSize(32, 32)), strokeColor(stroke));
+        });
+        document.endEdit("Stroke");
+    }
+}
+
+QPoint HistoryTest::strokePoint(int stroke)
+{
+    return QPoint(stroke % 4 * TiledSurface::TileSize + 16, stroke / 4 * TiledSurface::TileSize + 16);
+}
+
+QColor HistoryTest::strokeColor(int stroke)
+{
+    return QColor::fromHsv(stroke * 30, 255, 255).toRgb();
+}
+
+void HistoryTest::undoesPagedOutStrokes()
+{
+    HistoryManager manager;
+    // Without room in memory, every state but the current one is paged out
+    manager.setMemoryBudget(0);
+    Document document(1024, 1024);
+    document.setHistoryManager(&manager);
+    document.saveState("New Image");
+    paintStrokes(document);
+
+    QCOMPARE(manager.getHistorySize(), Strokes + 1);
+    QVERIFY(!manager.isStateResident(1));
+    QVERIFY(manager.getMemoryUsage() > 0);
+
+    while (document.canUndo()) {
+        document.undo();
+    }
+    const QImage undone = document.getActiveLayer()->getImage();
+    for (int stroke = 0; stroke < Strokes; ++stroke) {
+        QCOMPARE(undone.pixelColor(strokePoint(stroke)), QColor(Qt::white));
+    }
+
+    while (document.canRedo()) {
+        document.redo();
+    }
+    const QImage redone = document.getActiveLayer()->getImage();
+    for (int stroke = 0; stroke < Strokes; ++stroke) {
+        QCOMPARE(redone.pixelColor(strokePoint(stroke)), strokeColor(stroke));
+    }
+}
+
+void HistoryTest::foldsStrokesIntoOldestSnapshot()
+{
+    HistoryManager manager;
+    manager.setMemoryBudget(0);
+    Document document(1024, 1024);
+    document.setHistoryManager(&manager);
+    document.saveState("New Image");
+    paintStrokes(document);
+
+    // Out of disk, the oldest strokes are folded into the base snapshot,
+    // paging them back in as needed
+    QTRY_VERIFY(manager.getDiskUsage() > 0);
+    manager.setDiskBudget(0);
+    QVERIFY(manager.getHistorySize() < Strokes + 1);
+
+    while (document.canUndo()) {
+        document.undo();
+    }
+    const int kept = manager.getHistorySize() - 1;
+    const QImage undone = document.getActiveLayer()->getImage();
+    for (int stroke = 0; stroke < Strokes; ++stroke) {
+        const QColor expected = stroke < Strokes - kept ? strokeColor(stroke) : QColor(Qt::white);
+        QCOMPARE(undone.pixelColor(strokePoint(stroke)), expected);
+    }
+}
+
+QTEST_GUILESS_MAIN(HistoryTest)
+#include "history_test.moc"
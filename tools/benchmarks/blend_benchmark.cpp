@@ -0,0 +1,299 @@
+// Blend kernel throughput per mode and instruction set level, blending
+// encoded sRGB values and in linear light. When built against Qt, the
+// matching QPainter composition mode is timed alongside the sRGB kernels
+// for comparison with the previous compositing path. Every pixel format is
+// then checked for the same output at every level, blending, masked
+// blending, painting dabs and erasing, without timing.
+
+#include "core/blend.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef LIBREEFFECTS_BENCHMARK_QT
+#include <QImage>
+#include <QPainter>
+#endif
+
+using namespace LibreEffects::Core;
+
+namespace {
+
+    constexpr int Width = 1024;
+    constexpr int Height = 256;
+    constexpr int PixelCount = Width * Height;
+    constexpr float Opacity = 0.8f;
+    constexpr double MinimumSeconds = 0.25;
+
+    std::vector<uint32_t> randomPremultipliedPixels(unsigned seed)
+    {
+        std::mt19937 generator(seed);
+        std::uniform_int_distribution<int> byte(0, 255);
+        std::vector<uint32_t> pixels(PixelCount);
+        for (uint32_t& pixel : pixels) {
+            const int a = byte(generator);
+            const int r = a ? byte(generator) % (a + 1) : 0;
+            const int g = a ? byte(generator) % (a + 1) : 0;
+            const int b = a ? byte(generator) % (a + 1) : 0;
+            pixel = (static_cast<uint32_t>(a) << 24) | (r << 16) | (g << 8) | b;
+        }
+        return pixels;
+    }
+
+    const char* formatName(PixelFormat format)
+    {
+        switch (format) {
+            case PixelFormat::ARGB32: return "ARGB32";
+            case PixelFormat::RGBA64: return "RGBA64";
+            case PixelFormat::RGBA32F: return "RGBA32F";
+        }
+        return "Unknown";
+    }
+
+    // Random premultiplied pixels of any format, as raw bytes
+    std::vector<uint8_t> randomPixels(PixelFormat format, unsigned seed)
+    {
+        std::vector<uint8_t> bytes(static_cast<size_t>(PixelCount) * bytesPerPixel(format));
+        if (format == PixelFormat::ARGB32) {
+            const std::vector<uint32_t> pixels = randomPremultipliedPixels(seed);
+            std::memcpy(bytes.data(), pixels.data(), bytes.size());
+            return bytes;
+        }
+
+        std::mt19937 generator(seed);
+        std::uniform_int_distribution<int> word(0, 65535);
+        for (int i = 0; i < PixelCount; ++i) {
+            const int a = word(generator);
+            const int channels[4] = { a ? word(generator) % (a + 1) : 0, a ? word(generator) % (a + 1) : 0,
+                                      a ? word(generator) % (a + 1) : 0, a };
+            for (int c = 0; c < 4; ++c) {
+                if (format == PixelFormat::RGBA64) {
+                    const uint16_t value = static_cast<uint16_t>(channels[c]);
+                    std::memcpy(bytes.data() + (i * 4 + c) * sizeof(value), &value, sizeof(value));
+                } else {
+                    const float value = channels[c] / 65535.0f;
+                    std::memcpy(bytes.data() + (i * 4 + c) * sizeof(value), &value, sizeof(value));
+                }
+            }
+        }
+        return bytes;
+    }
+
+    // Runs the body repeatedly and returns megapixels per second
+    template <typename Body>
+    double measure(Body body)
+    {
+        using Clock = std::chrono::steady_clock;
+        body(); // warm up
+
+        int iterations = 0;
+        const auto start = Clock::now();
+        double elapsed = 0.0;
+        do {
+            body();
+            ++iterations;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        } while (elapsed < MinimumSeconds);
+
+        return static_cast<double>(PixelCount) * iterations / elapsed / 1.0e6;
+    }
+
+    void blendImage(BlendRowFunction function, std::vector<uint32_t>& dst, const std::vector<uint32_t>& src)
+    {
+        for (int y = 0; y < Height; ++y) {
+            function(dst.data() + y * Width, src.data() + y * Width, Width, Opacity);
+        }
+    }
+
+#ifdef LIBREEFFECTS_BENCHMARK_QT
+    QPainter::CompositionMode compositionMode(BlendMode mode)
+    {
+        static const QPainter::CompositionMode modes[BlendModeCount] = {
+            QPainter::CompositionMode_SourceOver,
+            QPainter::CompositionMode_Multiply,
+            QPainter::CompositionMode_Screen,
+            QPainter::CompositionMode_Overlay,
+            QPainter::CompositionMode_SoftLight,
+            QPainter::CompositionMode_HardLight,
+            QPainter::CompositionMode_ColorDodge,
+            QPainter::CompositionMode_ColorBurn,
+            QPainter::CompositionMode_Darken,
+            QPainter::CompositionMode_Lighten,
+            QPainter::CompositionMode_Difference,
+            QPainter::CompositionMode_Exclusion
+        };
+        return modes[static_cast<int>(mode)];
+    }
+#endif
+
+// Prints one table of rates per mode and level; returns false when a SIMD
+// level disagrees with the scalar kernels
+bool benchmarkSpace(BlendSpace space, const std::vector<uint32_t>& source, const std::vector<uint32_t>& backdrop,
+                    int levelCount)
+{
+    std::vector<uint32_t> destination(PixelCount);
+
+    std::printf("%-12s", blendSpaceName(space));
+    for (int level = 0; level < levelCount; ++level) {
+        std::printf("%12s", simdLevelName(static_cast<SimdLevel>(level)));
+    }
+#ifdef LIBREEFFECTS_BENCHMARK_QT
+    // QPainter only blends encoded values
+    if (space == BlendSpace::Srgb) {
+        std::printf("%12s%10s", "QPainter", "Speedup");
+    }
+#endif
+    std::printf("\n");
+
+    bool consistent = true;
+    for (int modeIndex = 0; modeIndex < BlendModeCount; ++modeIndex) {
+        const BlendMode mode = static_cast<BlendMode>(modeIndex);
+        std::printf("%-12s", blendModeName(mode));
+
+        std::vector<uint32_t> reference;
+        double fastest = 0.0;
+        for (int level = 0; level < levelCount; ++level) {
+            BlendRowFunction function = blendRowFunction(PixelFormat::ARGB32, mode, space,
+                                                         static_cast<SimdLevel>(level));
+
+            // Every level must produce the same pixels as the scalar code
+            destination = backdrop;
+            blendImage(function, destination, source);
+            if (reference.empty()) {
+                reference = destination;
+            } else if (std::memcmp(reference.data(), destination.data(), PixelCount * sizeof(uint32_t)) != 0) {
+                consistent = false;
+            }
+
+            const double rate = measure([&]() {
+                std::memcpy(destination.data(), backdrop.data(), PixelCount * sizeof(uint32_t));
+                blendImage(function, destination, source);
+            });
+            fastest = rate > fastest ? rate : fastest;
+            std::printf("%12.1f", rate);
+        }
+
+#ifdef LIBREEFFECTS_BENCHMARK_QT
+        if (space == BlendSpace::Srgb) {
+            QImage sourceImage(reinterpret_cast<const uchar*>(source.data()), Width, Height,
+                               Width * 4, QImage::Format_ARGB32_Premultiplied);
+            QImage destinationImage(reinterpret_cast<uchar*>(destination.data()), Width, Height,
+                                    Width * 4, QImage::Format_ARGB32_Premultiplied);
+            const double qtRate = measure([&]() {
+                std::memcpy(destination.data(), backdrop.data(), PixelCount * sizeof(uint32_t));
+                QPainter painter(&destinationImage);
+                painter.setCompositionMode(compositionMode(mode));
+                painter.setOpacity(Opacity);
+                painter.drawImage(0, 0, sourceImage);
+            });
+            std::printf("%12.1f%9.1fx", qtRate, fastest / qtRate);
+        }
+#endif
+        std::printf("\n");
+    }
+    return consistent;
+}
+
+// Runs every kernel of one format at every level: blending and masked
+// blending in each mode and space, brush dabs in each space, and erasing.
+// Rows are one pixel short so the padded tail runs too. Returns false when
+// a SIMD level disagrees with the scalar kernels.
+bool checkFormat(PixelFormat format, int levelCount)
+{
+    const int stride = Width * bytesPerPixel(format);
+    const int count = Width - 1;
+    const std::vector<uint8_t> source = randomPixels(format, 3);
+    const std::vector<uint8_t> backdrop = randomPixels(format, 4);
+    const float color[4] = { 0.2f * 0.9f, 0.4f * 0.9f, 0.8f * 0.9f, 0.9f };
+
+    // Random coverage, with plenty of fully hidden and fully shown pixels
+    std::vector<uint8_t> mask(PixelCount);
+    std::mt19937 generator(5);
+    std::uniform_int_distribution<int> byte(-64, 319);
+    for (uint8_t& coverage : mask) {
+        coverage = static_cast<uint8_t>(std::clamp(byte(generator), 0, 255));
+    }
+
+    bool consistent = true;
+    // The row body runs one kernel on one row at the given level
+    auto compare = [&](const std::string& label, auto row) {
+        std::vector<uint8_t> reference;
+        for (int level = 0; level < levelCount; ++level) {
+            std::vector<uint8_t> destination = backdrop;
+            for (int y = 0; y < Height; ++y) {
+                row(static_cast<SimdLevel>(level), destination.data() + y * stride, source.data() + y * stride,
+                    mask.data() + y * Width);
+            }
+            if (reference.empty()) {
+                reference = destination;
+            } else if (reference != destination) {
+                std::printf("%s %s differs at %s\n", formatName(format), label.c_str(),
+                            simdLevelName(static_cast<SimdLevel>(level)));
+                consistent = false;
+            }
+        }
+    };
+
+    for (int spaceIndex = 0; spaceIndex < BlendSpaceCount; ++spaceIndex) {
+        const BlendSpace space = static_cast<BlendSpace>(spaceIndex);
+        const std::string spaceLabel = blendSpaceName(space);
+        for (int modeIndex = 0; modeIndex < BlendModeCount; ++modeIndex) {
+            const BlendMode mode = static_cast<BlendMode>(modeIndex);
+            const std::string label = spaceLabel + " " + blendModeName(mode);
+            compare(label, [&](SimdLevel level, uint8_t* dst, const uint8_t* src, const uint8_t*) {
+                blendRowFunction(format, mode, space, level)(dst, src, count, Opacity);
+            });
+            compare(label + " masked", [&](SimdLevel level, uint8_t* dst, const uint8_t* src, const uint8_t* coverage) {
+                maskedBlendRowFunction(format, mode, space, level)(dst, src, coverage, count, Opacity);
+            });
+        }
+        float spaceColor[4];
+        dabColor(space, color, spaceColor);
+        compare(spaceLabel + " dab", [&](SimdLevel level, uint8_t* dst, const uint8_t*, const uint8_t* coverage) {
+            dabRowFunction(format, space, level)(dst, coverage, count, spaceColor, Opacity);
+        });
+    }
+    compare("erase", [&](SimdLevel level, uint8_t* dst, const uint8_t*, const uint8_t* coverage) {
+        eraseRowFunction(format, level)(dst, coverage, count, Opacity);
+    });
+    return consistent;
+}
+
+} // namespace
+
+int main()
+{
+    const std::vector<uint32_t> source = randomPremultipliedPixels(1);
+    const std::vector<uint32_t> backdrop = randomPremultipliedPixels(2);
+
+    const SimdLevel best = detectSimdLevel();
+    const int levelCount = static_cast<int>(best) + 1;
+
+    std::printf("Blend throughput, %dx%d premultiplied ARGB32, opacity %.2f (Mpixels/s)\n",
+                Width, Height, Opacity);
+    std::printf("CPU supports up to %s\n\n", simdLevelName(best));
+
+    bool consistent = true;
+    for (int space = 0; space < BlendSpaceCount; ++space) {
+        if (space > 0) std::printf("\n");
+        consistent = benchmarkSpace(static_cast<BlendSpace>(space), source, backdrop, levelCount) && consistent;
+    }
+
+    std::printf("\n");
+    for (int formatIndex = 0; formatIndex < PixelFormatCount; ++formatIndex) {
+        const PixelFormat format = static_cast<PixelFormat>(formatIndex);
+        const bool formatConsistent = checkFormat(format, levelCount);
+        std::printf("%-12s%s at every level\n", formatName(format), formatConsistent ? "identical" : "NOT identical");
+        consistent = formatConsistent && consistent;
+    }
+
+    if (!consistent) {
+        std::printf("\nWARNING: SIMD output differs from the scalar kernels\n");
+        return 1;
+    }
+    return 0;
+}
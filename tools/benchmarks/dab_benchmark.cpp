@@ -0,0 +1,374 @@
+// Brush dab throughput per stamp size and instruction set level: painting
+// source-over in encoded sRGB and in linear light, and erasing. When built
+// against Qt, the previous path of drawing a pre-tinted stamp with QPainter
+// per dab is timed alongside for comparison. Every format's kernels are
+// also checked for the same output at every level, without timing.
+
+#include "core/blend.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef LIBREEFFECTS_BENCHMARK_QT
+#include <QImage>
+#include <QPainter>
+#endif
+
+using namespace LibreEffects::Core;
+
+namespace {
+
+    constexpr int CanvasSize = 1024;
+    constexpr int PixelCount = CanvasSize * CanvasSize;
+    constexpr float Opacity = 0.8f;
+    constexpr float Hardness = 0.5f;
+    constexpr double MinimumSeconds = 0.25;
+    // Premultiplied R, G, B, A
+    constexpr float Color[4] = { 0.2f * 0.9f, 0.4f * 0.9f, 0.8f * 0.9f, 0.9f };
+    // Roughly this many stamp pixels per timed batch, whatever the size
+    constexpr int BatchPixels = 1 << 20;
+
+    const int Sizes[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1000 };
+
+    enum class Operation {
+        PaintSrgb,
+        PaintLinear,
+        Erase
+    };
+
+    const char* operationName(Operation operation)
+    {
+        switch (operation) {
+            case Operation::PaintSrgb: return "Paint sRGB";
+            case Operation::PaintLinear: return "Paint Linear";
+            case Operation::Erase: return "Erase";
+        }
+        return "Unknown";
+    }
+
+    const char* formatName(PixelFormat format)
+    {
+        switch (format) {
+            case PixelFormat::ARGB32: return "ARGB32";
+            case PixelFormat::RGBA64: return "RGBA64";
+            case PixelFormat::RGBA32F: return "RGBA32F";
+        }
+        return "Unknown";
+    }
+
+    // Round coverage stamp as the brush tools rasterize it
+    struct Stamp {
+        int extent;
+        std::vector<uint8_t> coverage;
+    };
+
+    Stamp makeStamp(int size)
+    {
+        const float radius = size / 2.0f;
+        const int margin = static_cast<int>(std::ceil(radius)) + 1;
+        Stamp stamp;
+        stamp.extent = 2 * margin + 1;
+        stamp.coverage.resize(static_cast<size_t>(stamp.extent) * stamp.extent);
+
+        const float inner = radius * Hardness;
+        const float falloff = radius - inner;
+        for (int y = 0; y < stamp.extent; ++y) {
+            for (int x = 0; x < stamp.extent; ++x) {
+                const float dx = x + 0.5f - margin;
+                const float dy = y + 0.5f - margin;
+                const float distance = std::sqrt(dx * dx + dy * dy);
+                float coverage = std::clamp(radius - distance + 0.5f, 0.0f, 1.0f);
+                if (falloff > 0.0f && distance > inner) {
+                    coverage *= std::max(0.0f, 1.0f - (distance - inner) / falloff);
+                }
+                stamp.coverage[y * stamp.extent + x] = static_cast<uint8_t>(coverage * 255.0f + 0.5f);
+            }
+        }
+        return stamp;
+    }
+
+    std::vector<uint32_t> randomPremultipliedPixels(unsigned seed)
+    {
+        std::mt19937 generator(seed);
+        std::uniform_int_distribution<int> byte(0, 255);
+        std::vector<uint32_t> pixels(PixelCount);
+        for (uint32_t& pixel : pixels) {
+            const int a = byte(generator);
+            const int r = a ? byte(generator) % (a + 1) : 0;
+            const int g = a ? byte(generator) % (a + 1) : 0;
+            const int b = a ? byte(generator) % (a + 1) : 0;
+            pixel = (static_cast<uint32_t>(a) << 24) | (r << 16) | (g << 8) | b;
+        }
+        return pixels;
+    }
+
+    // Random premultiplied pixels of any format, as raw bytes
+    std::vector<uint8_t> randomPixels(PixelFormat format, unsigned seed)
+    {
+        if (format == PixelFormat::ARGB32) {
+            const std::vector<uint32_t> pixels = randomPremultipliedPixels(seed);
+            std::vector<uint8_t> bytes(pixels.size() * sizeof(uint32_t));
+            std::memcpy(bytes.data(), pixels.data(), bytes.size());
+            return bytes;
+        }
+
+        std::mt19937 generator(seed);
+        std::uniform_int_distribution<int> word(0, 65535);
+        std::vector<uint8_t> bytes(static_cast<size_t>(PixelCount) * bytesPerPixel(format));
+        for (int i = 0; i < PixelCount; ++i) {
+            const int a = word(generator);
+            const int channels[4] = { a ? word(generator) % (a + 1) : 0, a ? word(generator) % (a + 1) : 0,
+                                      a ? word(generator) % (a + 1) : 0, a };
+            for (int c = 0; c < 4; ++c) {
+                if (format == PixelFormat::RGBA64) {
+                    const uint16_t value = static_cast<uint16_t>(channels[c]);
+                    std::memcpy(bytes.data() + (i * 4 + c) * sizeof(value), &value, sizeof(value));
+                } else {
+                    const float value = channels[c] / 65535.0f;
+                    std::memcpy(bytes.data() + (i * 4 + c) * sizeof(value), &value, sizeof(value));
+                }
+            }
+        }
+        return bytes;
+    }
+
+    // Dab positions along a diagonal, overlapping like a stroke would
+    std::vector<int> dabOffsets(int extent, int count)
+    {
+        const int range = CanvasSize - extent;
+        const int step = std::max(1, extent / 10);
+        std::vector<int> offsets(count);
+        for (int i = 0; i < count; ++i) {
+            offsets[i] = range > 0 ? (i * step) % range : 0;
+        }
+        return offsets;
+    }
+
+    // Runs the body, which stamps dabCount dabs, repeatedly and returns dabs per second
+    template <typename Body>
+    double measure(int dabCount, Body body)
+    {
+        using Clock = std::chrono::steady_clock;
+        body(); // warm up
+
+        int iterations = 0;
+        const auto start = Clock::now();
+        double elapsed = 0.0;
+        do {
+            body();
+            ++iterations;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        } while (elapsed < MinimumSeconds);
+
+        return static_cast<double>(dabCount) * iterations / elapsed;
+    }
+
+    void stampDabs(Operation operation, PixelFormat format, SimdLevel level, const Stamp& stamp,
+                   const std::vector<int>& offsets, void* canvas)
+    {
+        const BlendSpace space = operation == Operation::PaintLinear ? BlendSpace::Linear : BlendSpace::Srgb;
+        const DabRowFunction paint = dabRowFunction(format, space, level);
+        const EraseRowFunction erase = eraseRowFunction(format, level);
+        float color[4];
+        dabColor(space, Color, color);
+        const int bytesPerPixel = LibreEffects::Core::bytesPerPixel(format);
+
+        for (int offset : offsets) {
+            for (int y = 0; y < stamp.extent; ++y) {
+                uint8_t* row = static_cast<uint8_t*>(canvas) + ((offset + y) * CanvasSize + offset) * bytesPerPixel;
+                const uint8_t* coverage = stamp.coverage.data() + y * stamp.extent;
+                if (operation == Operation::Erase) {
+                    erase(row, coverage, stamp.extent, Opacity);
+                } else {
+                    paint(row, coverage, stamp.extent, color, Opacity);
+                }
+            }
+        }
+    }
+
+    std::string formatRate(double rate)
+    {
+        char text[32];
+        if (rate >= 1.0e6) {
+            std::snprintf(text, sizeof(text), "%.2fM", rate / 1.0e6);
+        } else if (rate >= 1.0e3) {
+            std::snprintf(text, sizeof(text), "%.1fk", rate / 1.0e3);
+        } else {
+            std::snprintf(text, sizeof(text), "%.0f", rate);
+        }
+        return text;
+    }
+
+#ifdef LIBREEFFECTS_BENCHMARK_QT
+    // The stamp as premultiplied color, the way the brush tools used to
+    // cache it for QPainter
+    QImage tintedStamp(const Stamp& stamp, bool erase)
+    {
+        QImage image(stamp.extent, stamp.extent, QImage::Format_ARGB32_Premultiplied);
+        for (int y = 0; y < stamp.extent; ++y) {
+            uint32_t* row = reinterpret_cast<uint32_t*>(image.scanLine(y));
+            for (int x = 0; x < stamp.extent; ++x) {
+                const float coverage = stamp.coverage[y * stamp.extent + x] / 255.0f;
+                const float a = erase ? coverage : Color[3] * coverage;
+                const float r = erase ? 0.0f : Color[0] * coverage;
+                const float g = erase ? 0.0f : Color[1] * coverage;
+                const float b = erase ? 0.0f : Color[2] * coverage;
+                row[x] = (static_cast<uint32_t>(a * 255.0f + 0.5f) << 24)
+                         | (static_cast<uint32_t>(r * 255.0f + 0.5f) << 16)
+                         | (static_cast<uint32_t>(g * 255.0f + 0.5f) << 8)
+                         | static_cast<uint32_t>(b * 255.0f + 0.5f);
+            }
+        }
+        return image;
+    }
+#endif
+
+    // Prints one table of dab rates per stamp size and level; returns false
+    // when a SIMD level disagrees with the scalar kernels
+    bool benchmarkOperation(Operation operation, const std::vector<uint32_t>& backdrop, int levelCount)
+    {
+        std::vector<uint32_t> canvas(PixelCount);
+
+        std::printf("%-14s", operationName(operation));
+        for (int level = 0; level < levelCount; ++level) {
+            std::printf("%12s", simdLevelName(static_cast<SimdLevel>(level)));
+        }
+#ifdef LIBREEFFECTS_BENCHMARK_QT
+        // QPainter only composites encoded values
+        if (operation != Operation::PaintLinear) {
+            std::printf("%12s%10s", "QPainter", "Speedup");
+        }
+#endif
+        std::printf("\n");
+
+        bool consistent = true;
+        for (int size : Sizes) {
+            const Stamp stamp = makeStamp(size);
+            const int dabCount = std::max(1, BatchPixels / (stamp.extent * stamp.extent));
+            const std::vector<int> offsets = dabOffsets(stamp.extent, dabCount);
+
+            char label[16];
+            std::snprintf(label, sizeof(label), "%d px", size);
+            std::printf("%-14s", label);
+
+            std::vector<uint32_t> reference;
+            double fastest = 0.0;
+            for (int level = 0; level < levelCount; ++level) {
+                // Every level must produce the same pixels as the scalar code
+                canvas = backdrop;
+                stampDabs(operation, PixelFormat::ARGB32, static_cast<SimdLevel>(level), stamp, offsets, canvas.data());
+                if (reference.empty()) {
+                    reference = canvas;
+                } else if (std::memcmp(reference.data(), canvas.data(), PixelCount * sizeof(uint32_t)) != 0) {
+                    consistent = false;
+                }
+
+                // Dabs keep piling onto the same canvas; only the first pass starts
+                // from the backdrop. Erasing soon meets cleared pixels, which the
+                // kernels skip just as they do along a real stroke.
+                canvas = backdrop;
+                const double rate = measure(dabCount, [&]() {
+                    stampDabs(operation, PixelFormat::ARGB32, static_cast<SimdLevel>(level), stamp, offsets, canvas.data());
+                });
+                fastest = rate > fastest ? rate : fastest;
+                std::printf("%12s", formatRate(rate).c_str());
+            }
+
+#ifdef LIBREEFFECTS_BENCHMARK_QT
+            if (operation != Operation::PaintLinear) {
+                canvas = backdrop;
+                const bool erase = operation == Operation::Erase;
+                const QImage tinted = tintedStamp(stamp, erase);
+                QImage canvasImage(reinterpret_cast<uchar*>(canvas.data()), CanvasSize, CanvasSize,
+                                   CanvasSize * 4, QImage::Format_ARGB32_Premultiplied);
+                const double qtRate = measure(dabCount, [&]() {
+                    // One painter per batch, as per input event; setup per dab is
+                    // the opacity and the image draw
+                    QPainter painter(&canvasImage);
+                    painter.setCompositionMode(erase ? QPainter::CompositionMode_DestinationOut
+                                                     : QPainter::CompositionMode_SourceOver);
+                    for (int offset : offsets) {
+                        painter.setOpacity(Opacity);
+                        painter.drawImage(offset, offset, tinted);
+                    }
+                });
+                std::printf("%12s%9.1fx", formatRate(qtRate).c_str(), fastest / qtRate);
+            }
+#endif
+            std::printf("\n");
+        }
+        return consistent;
+    }
+
+    // Stamps every size and operation on a canvas of the format at each
+    // level without timing; returns false when a SIMD level disagrees with
+    // the scalar kernels
+    bool checkFormat(PixelFormat format, int levelCount)
+    {
+        const std::vector<uint8_t> backdrop = randomPixels(format, 2);
+        const Operation operations[] = { Operation::PaintSrgb, Operation::PaintLinear, Operation::Erase };
+
+        bool consistent = true;
+        for (Operation operation : operations) {
+            for (int size : Sizes) {
+                const Stamp stamp = makeStamp(size);
+                // A few overlapping dabs are enough to compare
+                const std::vector<int> offsets = dabOffsets(stamp.extent, 8);
+
+                std::vector<uint8_t> reference;
+                for (int level = 0; level < levelCount; ++level) {
+                    std::vector<uint8_t> canvas = backdrop;
+                    stampDabs(operation, format, static_cast<SimdLevel>(level), stamp, offsets, canvas.data());
+                    if (reference.empty()) {
+                        reference = canvas;
+                    } else if (reference != canvas) {
+                        std::printf("%s %s %d px differs at %s\n", formatName(format), operationName(operation), size,
+                                    simdLevelName(static_cast<SimdLevel>(level)));
+                        consistent = false;
+                    }
+                }
+            }
+        }
+        return consistent;
+    }
+
+} // namespace
+
+int main()
+{
+    const std::vector<uint32_t> backdrop = randomPremultipliedPixels(1);
+
+    const SimdLevel best = detectSimdLevel();
+    const int levelCount = static_cast<int>(best) + 1;
+
+    std::printf("Dab throughput on a %dx%d premultiplied ARGB32 canvas, hardness %.2f, opacity %.2f (dabs/s)\n",
+                CanvasSize, CanvasSize, Hardness, Opacity);
+    std::printf("CPU supports up to %s\n\n", simdLevelName(best));
+
+    bool consistent = true;
+    const Operation operations[] = { Operation::PaintSrgb, Operation::PaintLinear, Operation::Erase };
+    for (Operation operation : operations) {
+        if (operation != operations[0]) std::printf("\n");
+        consistent = benchmarkOperation(operation, backdrop, levelCount) && consistent;
+    }
+
+    // Every format is checked per operation and size, naming the first
+    // level that differs; the deeper formats are not timed
+    std::printf("\n");
+    for (PixelFormat format : { PixelFormat::ARGB32, PixelFormat::RGBA64, PixelFormat::RGBA32F }) {
+        const bool formatConsistent = checkFormat(format, levelCount);
+        std::printf("%-14s%s at every level\n", formatName(format), formatConsistent ? "identical" : "NOT identical");
+        consistent = formatConsistent && consistent;
+    }
+
+    if (!consistent) {
+        std::printf("\nWARNING: SIMD output differs from the scalar kernels\n");
+        return 1;
+    }
+    return 0;
+}